@@ -7,6 +7,18 @@
 #include <sstream>
 #include <stdexcept>
 #include <cstdlib>
+#include <memory>
+#include <functional>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <type_traits>
+#include <string_view>
 #include <windows.h>
 
 //// Function to delete temporary files by setting attributes to normal
@@ -105,6 +117,229 @@
 //
 //}
 
+// Source of lines for the comparator, fed either from a file on disk or from a converter's output pipe
+class LineReader {
+
+public:
+    virtual ~LineReader() = default;
+
+    // Reads the next line without its terminator, returns false at the end of the input
+    virtual bool nextLine(std::string& line) = 0;
+};
+
+// Reads lines straight from a file on disk, used for formats that need no conversion
+class FileLineReader : public LineReader {
+
+    std::ifstream file;
+
+public:
+    FileLineReader(const std::string& path) : file(path) {
+        if (!file) throw std::runtime_error("File not found: " + path);
+    }
+
+    bool nextLine(std::string& line) override {
+        return static_cast<bool>(std::getline(file, line));
+    }
+};
+
+// Splits a stream of bytes read in chunks into lines, dropping CR line ending characters and blank lines in the same pass
+class SplittingLineReader : public LineReader {
+
+    std::vector<char> buffer;
+    size_t bufferStart = 0;
+    size_t bufferEnd = 0;
+    bool endOfStream = false;
+
+    void fillBuffer() {
+        size_t bytesRead = readChunk(buffer.data(), buffer.size());
+        if (bytesRead == 0) endOfStream = true;
+        bufferStart = 0;
+        bufferEnd = bytesRead;
+    }
+
+protected:
+    SplittingLineReader(size_t chunkSize) : buffer(chunkSize) {}
+
+    // Reads up to size bytes into data, returns 0 at the end of the stream
+    virtual size_t readChunk(char* data, size_t size) = 0;
+
+    // Called once after the last line was read
+    virtual void finish() {}
+
+public:
+    bool nextLine(std::string& line) override {
+
+        line.clear();
+        while (true) {
+
+            // Look for the end of the line in the buffered output
+            const char* begin = buffer.data() + bufferStart;
+            const char* end = buffer.data() + bufferEnd;
+            const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+
+            if (newline != nullptr || endOfStream) {
+                const char* lineEnd = newline != nullptr ? newline : end;
+                line.append(begin, lineEnd);
+                bufferStart = newline != nullptr ? (newline - buffer.data()) + 1 : bufferEnd;
+
+                // Converters on Windows write CRLF line endings
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+
+                // Only return non-empty lines
+                if (!line.empty()) return true;
+                if (newline == nullptr) {
+                    finish();
+                    return false;
+                }
+                continue;
+            }
+
+            // Keep the partial line and read more output
+            line.append(begin, end);
+            fillBuffer();
+        }
+    }
+};
+
+// Runs an external converter and splits its standard output into lines while it is being produced
+// Blank lines are dropped in the same pass, so no intermediate file or shell is involved
+class ProcessLineReader : public SplittingLineReader {
+
+    static constexpr size_t chunkSize = 64 * 1024;
+
+    std::string sourcePath;
+    HANDLE process = nullptr;
+    HANDLE outputPipe = nullptr;
+
+    // An error or a closed pipe marks the end of the converter output
+    size_t readChunk(char* data, size_t size) override {
+        DWORD bytesRead = 0;
+        if (!ReadFile(outputPipe, data, static_cast<DWORD>(size), &bytesRead, nullptr)) return 0;
+        return bytesRead;
+    }
+
+    // Waits for the converter to exit and reports a failed conversion
+    void finish() override {
+        if (process == nullptr) return;
+
+        DWORD exitCode = 1;
+        WaitForSingleObject(process, INFINITE);
+        GetExitCodeProcess(process, &exitCode);
+        closeHandles();
+
+        if (exitCode != 0) {
+            std::cerr << "Error converting file: " << sourcePath << std::endl;
+            throw std::runtime_error("Failed to convert file: " + sourcePath);
+        }
+    }
+
+    void closeHandles() {
+        if (outputPipe != nullptr) CloseHandle(outputPipe);
+        if (process != nullptr) CloseHandle(process);
+        outputPipe = nullptr;
+        process = nullptr;
+    }
+
+    // Reports a failed Windows call while starting the converter
+    [[noreturn]] void failStart(const std::string& step, DWORD error) {
+        std::cerr << "Failed to start converter for: " << sourcePath << ". " << step << " failed with Error Code: " << error << std::endl;
+        throw std::runtime_error("Failed to convert file: " + sourcePath);
+    }
+
+public:
+    ProcessLineReader(const std::wstring& commandLine, const std::string& sourcePath) : SplittingLineReader(chunkSize), sourcePath(sourcePath) {
+
+        // Pipe for the converter's standard output, only the write end is inheritable
+        SECURITY_ATTRIBUTES security = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+        HANDLE readEnd = nullptr;
+        HANDLE writeEnd = nullptr;
+        if (!CreatePipe(&readEnd, &writeEnd, &security, 0)) {
+            failStart("CreatePipe", GetLastError());
+        }
+        if (!SetHandleInformation(readEnd, HANDLE_FLAG_INHERIT, 0)) {
+            DWORD error = GetLastError();
+            CloseHandle(readEnd);
+            CloseHandle(writeEnd);
+            failStart("SetHandleInformation", error);
+        }
+
+        // Standard input and error go to NUL
+        HANDLE nullDevice = CreateFileW(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &security, OPEN_EXISTING, 0, nullptr);
+        if (nullDevice == INVALID_HANDLE_VALUE) {
+            DWORD error = GetLastError();
+            CloseHandle(readEnd);
+            CloseHandle(writeEnd);
+            failStart("Opening NUL", error);
+        }
+
+        // Restrict inheritance to exactly these handles, so a converter started from another thread never holds our pipe open
+        // The first call only reports the required size and is expected to fail
+        HANDLE inheritedHandles[] = { writeEnd, nullDevice };
+        SIZE_T attributeSize = 0;
+        InitializeProcThreadAttributeList(nullptr, 1, 0, &attributeSize);
+        std::vector<char> attributeBuffer(attributeSize);
+        LPPROC_THREAD_ATTRIBUTE_LIST attributes = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributeBuffer.data());
+
+        if (attributeSize == 0 || !InitializeProcThreadAttributeList(attributes, 1, 0, &attributeSize)) {
+            DWORD error = GetLastError();
+            CloseHandle(readEnd);
+            CloseHandle(writeEnd);
+            CloseHandle(nullDevice);
+            failStart("InitializeProcThreadAttributeList", error);
+        }
+        if (!UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inheritedHandles, sizeof(inheritedHandles), nullptr, nullptr)) {
+            DWORD error = GetLastError();
+            DeleteProcThreadAttributeList(attributes);
+            CloseHandle(readEnd);
+            CloseHandle(writeEnd);
+            CloseHandle(nullDevice);
+            failStart("UpdateProcThreadAttribute", error);
+        }
+
+        STARTUPINFOEXW startupInfo = {};
+        startupInfo.StartupInfo.cb = sizeof(startupInfo);
+        startupInfo.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startupInfo.StartupInfo.hStdInput = nullDevice;
+        startupInfo.StartupInfo.hStdOutput = writeEnd;
+        startupInfo.StartupInfo.hStdError = nullDevice;
+        startupInfo.lpAttributeList = attributes;
+
+        // CreateProcessW may modify the command line buffer, so pass a private copy
+        std::wstring mutableCommandLine = commandLine;
+        PROCESS_INFORMATION processInfo = {};
+        BOOL created = CreateProcessW(nullptr, mutableCommandLine.data(), nullptr, nullptr, TRUE,
+            EXTENDED_STARTUPINFO_PRESENT | CREATE_NO_WINDOW, nullptr, nullptr, &startupInfo.StartupInfo, &processInfo);
+        DWORD error = GetLastError();
+
+        // The child owns its copies now, the write end must be closed here so the pipe reports EOF when the converter exits
+        DeleteProcThreadAttributeList(attributes);
+        CloseHandle(writeEnd);
+        CloseHandle(nullDevice);
+
+        if (!created) {
+            CloseHandle(readEnd);
+            failStart("CreateProcessW", error);
+        }
+
+        CloseHandle(processInfo.hThread);
+        process = processInfo.hProcess;
+        outputPipe = readEnd;
+    }
+
+    ~ProcessLineReader() {
+
+        // Stop a converter whose output was not read to the end, e.g. after an error in the other file
+        if (process != nullptr) {
+            TerminateProcess(process, 1);
+            WaitForSingleObject(process, INFINITE);
+        }
+        closeHandles();
+    }
+
+    ProcessLineReader(const ProcessLineReader&) = delete;
+    ProcessLineReader& operator=(const ProcessLineReader&) = delete;
+};
+
 // Represents a file in the system
 class File {
 
@@ -147,181 +382,1539 @@ public:
         }
     }
 
-    // Function to convert .docx, or .odt to .txt using Pandoc's command
-    std::string convertToTxt(const std::string& inputFilePath, const std::string& outputDir) {
+    /*std::vector<std::string> retrieveContent() {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("File not found: " + path);
 
-        // Convert input file path to absolute path
-        std::filesystem::path inputAbsPath = std::filesystem::absolute(inputFilePath);
+        // FR.11
+        if (file.peek() == std::ifstream::traits_type::eof()) {
+            throw std::runtime_error("Error: The file \"" + path + "\" is empty.");
+        }
 
-        // Convert outputDir to a std::filesystem::path
-        std::filesystem::path outputDirPath(outputDir);
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line)) {
+            // Trim whitespace and check if the line is empty
+            if (!line.empty()) {
+                lines.push_back(line);
+            }
+        }
 
-        // Extract the file name without extension
-        std::filesystem::path inputPath(inputAbsPath);
-        std::string outputFileName = inputPath.stem().string() + ".txt";
+        file.close();
+        return lines;
+    }*/
 
-        // Combine the output directory and the output file name
-        std::filesystem::path outputFilePath = outputDirPath / outputFileName;
+    std::string getPath() { return path; }
+    std::string getName() { return name; }
+    std::string getExtension() { return format; }
 
-        // Construct the Pandoc command with --wrap=none
-        std::string command = "pandoc --to=plain+smart --wrap=none \"" + inputAbsPath.string() + "\" -o \"" + outputFilePath.string() + "\"";
+};
 
-        // Execute the command
-        int result = system(command.c_str());
+// Creates the line reader for one input file
+using ConverterFactory = std::function<std::unique_ptr<LineReader>(const std::string& path)>;
 
-        // Check for errors during conversion
-        if (result != 0) {
-            std::cerr << "Error converting file: " << inputAbsPath.string() << std::endl;
-            throw std::runtime_error("Failed to convert file: " + inputAbsPath.string());
-        }
-        else {
-            std::cout << "File successfully converted to: " << outputFilePath.string() << std::endl;
-        }
+// Maps file formats to converters, looked up by extension first and by leading magic bytes otherwise
+class ConverterRegistry {
 
-        // Temporary file for cleaned content
-        const std::string tempFilePath = "temp_output.txt";
+    struct MagicRule {
+        size_t offset;
+        std::string bytes;
+        ConverterFactory factory;
+        std::function<bool(const std::string&)> confirm;    // Optional further check on the whole file
+    };
 
-        // Open the original output file and the temporary file
-        std::ifstream inputFile(outputFilePath);
-        std::ofstream tempFile(tempFilePath);
+    std::map<std::string, ConverterFactory> byExtension;
+    std::vector<MagicRule> byMagic;
 
-        if (!inputFile.is_open() || !tempFile.is_open()) {
-            std::cerr << "Error: Unable to open files for processing." << std::endl;
-            throw std::runtime_error("File not found: " + outputFilePath.string() + " or " + tempFilePath);
-        }
+    static std::string toLower(std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return text;
+    }
 
-        // Remove empty lines from the file
-        std::string line;
-        while (std::getline(inputFile, line)) {
-            if (!line.empty()) {  // Only write non-empty lines
-                tempFile << line << "\n";
+    // First rule matching the start of the file, nullptr when none does
+    const MagicRule* findMagic(const std::string& path) const {
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error("File not found: " + path);
+        std::string header(128, '\0');
+        file.read(&header[0], header.size());
+        header.resize(static_cast<size_t>(file.gcount()));
+
+        for (const auto& rule : byMagic) {
+            if (header.size() >= rule.offset + rule.bytes.size() && header.compare(rule.offset, rule.bytes.size(), rule.bytes) == 0
+                && (!rule.confirm || rule.confirm(path))) {
+                return &rule;
             }
         }
+        return nullptr;
+    }
 
-        // Close the files
-        inputFile.close();
-        tempFile.close();
+    // Looks an entry up in the central directory at the end of a ZIP package
+    static bool zipHasEntry(const std::string& path, const std::string& entryName) {
 
-        deleteTemporaryFile(outputFilePath.string());
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return false;
+        std::uint64_t fileSize = static_cast<std::uint64_t>(file.tellg());
 
-        // Rename the temporary file to the original file name
-        try {
-            std::filesystem::rename(tempFilePath, outputFilePath);
+        auto get16 = [](const std::string& bytes, size_t at) {
+            return static_cast<std::uint32_t>(static_cast<unsigned char>(bytes[at]) | static_cast<unsigned char>(bytes[at + 1]) << 8);
+        };
+        auto get32 = [&get16](const std::string& bytes, size_t at) { return get16(bytes, at) | get16(bytes, at + 2) << 16; };
+
+        // The end of central directory record is 22 bytes followed by a comment of up to 64 KB
+        std::string tail(static_cast<size_t>(std::min<std::uint64_t>(fileSize, 22 + 0xFFFF)), '\0');
+        file.seekg(static_cast<std::streamoff>(fileSize - tail.size()));
+        if (!file.read(&tail[0], tail.size())) return false;
+
+        size_t end = tail.rfind(std::string("PK\x05\x06", 4));
+        if (end == std::string::npos || end + 22 > tail.size()) return false;
+        std::uint32_t directorySize = get32(tail, end + 12);
+        std::uint32_t directoryOffset = get32(tail, end + 16);
+        if (directorySize == 0 || directorySize > 16 * 1024 * 1024 || std::uint64_t(directoryOffset) + directorySize > fileSize) return false;
+
+        std::string directory(directorySize, '\0');
+        file.seekg(directoryOffset);
+        if (!file.read(&directory[0], directory.size())) return false;
+
+        // Central directory headers are 46 bytes followed by the name, extra field and comment
+        size_t at = 0;
+        while (at + 46 <= directory.size() && directory.compare(at, 4, "PK\x01\x02", 4) == 0) {
+            size_t nameLength = get16(directory, at + 28);
+            size_t next = at + 46 + nameLength + get16(directory, at + 30) + get16(directory, at + 32);
+            if (next > directory.size()) return false;
+            if (directory.compare(at + 46, nameLength, entryName) == 0) return true;
+            at = next;
         }
-        catch (const std::exception& ex) {
-            std::cerr << "Error renaming temporary file: " << ex.what() << std::endl;
+        return false;
+    }
+
+public:
+    // Register a converter for an extension such as ".rtf", matched case-insensitively
+    void registerExtension(const std::string& extension, ConverterFactory factory) {
+        byExtension[toLower(extension)] = std::move(factory);
+    }
+
+    // Register a converter for files carrying the given bytes at the given offset, earlier rules win
+    // A confirm check, when given, must also accept the file, for formats sharing a container such as ZIP
+    void registerMagic(size_t offset, const std::string& bytes, ConverterFactory factory, std::function<bool(const std::string&)> confirm = nullptr) {
+        byMagic.push_back({ offset, bytes, std::move(factory), std::move(confirm) });
+    }
+
+    bool hasExtension(const std::string& extension) const {
+        return byExtension.count(toLower(extension)) != 0;
+    }
+
+    // Whether open() would pick a converter for the file by its first bytes
+    bool matchesMagic(const std::string& path) const {
+        return findMagic(path) != nullptr;
+    }
+
+    std::unique_ptr<LineReader> open(const std::string& path, const std::string& extension) const {
+
+        auto found = byExtension.find(toLower(extension));
+        if (found != byExtension.end()) {
+            return found->second(path);
         }
 
-        // Return the output file path as a string
-        return outputFilePath.string();
+        // Unknown extension, sniff the start of the file
+        const MagicRule* rule = findMagic(path);
+        if (rule) {
+            return rule->factory(path);
+        }
 
+        throw std::runtime_error("Unsupported file format: " + path);
     }
 
-    /*std::vector<std::string> retrieveContent() {
-        std::ifstream file(path);
-        if (!file)
-            throw std::runtime_error("File not found: " + path);
+    // Plain text is read directly
+    static ConverterFactory plainText() {
+        return [](const std::string& path) { return std::unique_ptr<LineReader>(new FileLineReader(path)); };
+    }
 
-        // FR.11
-        if (file.peek() == std::ifstream::traits_type::eof()) {
-            throw std::runtime_error("Error: The file \"" + path + "\" is empty.");
+    // Pandoc converts to plain text on its standard output with --wrap=none
+    static ConverterFactory pandoc(const std::string& fromFormat) {
+        return [fromFormat](const std::string& path) {
+            std::filesystem::path inputAbsPath = std::filesystem::absolute(path);
+            std::wstring commandLine = L"pandoc --from=" + std::filesystem::path(fromFormat).wstring()
+                + L" --to=plain+smart --wrap=none \"" + inputAbsPath.wstring() + L"\"";
+            return std::unique_ptr<LineReader>(new ProcessLineReader(commandLine, inputAbsPath.string()));
+        };
+    }
+
+    // Formats supported out of the box, built once and shared read-only between threads
+    static const ConverterRegistry& defaultRegistry() {
+        static const ConverterRegistry registry = [] {
+            ConverterRegistry defaults;
+            defaults.registerExtension(".txt", plainText());
+            defaults.registerExtension(".docx", pandoc("docx"));
+            defaults.registerExtension(".odt", pandoc("odt"));
+            defaults.registerExtension(".rtf", pandoc("rtf"));
+            defaults.registerExtension(".html", pandoc("html"));
+            defaults.registerExtension(".htm", pandoc("html"));
+            defaults.registerExtension(".md", pandoc("markdown"));
+
+            // An ODF package stores its uncompressed mimetype entry first, a Word package has its main document part
+            // Any other ZIP, such as a spreadsheet or a plain archive, is left to the byte comparison
+            defaults.registerMagic(30, "mimetypeapplication/vnd.oasis.opendocument.text", pandoc("odt"));
+            defaults.registerMagic(0, std::string("PK\x03\x04", 4), pandoc("docx"),
+                [](const std::string& path) { return zipHasEntry(path, "word/document.xml"); });
+            defaults.registerMagic(0, "{\\rtf", pandoc("rtf"));
+            return defaults;
+        }();
+        return registry;
+    }
+};
+
+// Line boundaries of a text buffer holding one "\n"-terminated line after another
+class LineIndex {
+
+    // Start offset of every line, followed by the end of the text
+    std::vector<size_t> starts{ 0 };
+
+public:
+    void append(std::string& text, const std::string& line) {
+        text += line;
+        text += '\n';
+        starts.push_back(text.size());
+    }
+
+    size_t lineCount() const { return starts.size() - 1; }
+
+    // The line without its terminator, viewing into the indexed text
+    std::string_view line(const std::string& text, size_t lineIndex) const {
+        return std::string_view(text.data() + starts[lineIndex], starts[lineIndex + 1] - starts[lineIndex] - 1);
+    }
+};
+
+// Kind of a run of differing lines
+enum class HunkKind : unsigned char {
+    Changed,    // Both files have the lines, with different content
+    Added,      // Lines only in the second file
+    Removed     // Lines only in the first file
+};
+
+// One run of differences, starts and counts are lines in each file's LineIndex, or bytes in a byte comparison
+struct Hunk {
+    HunkKind kind;
+    size_t firstStart;
+    size_t firstCount;
+    size_t secondStart;
+    size_t secondCount;
+};
+
+// Differences between two files as runs of lines, stored as a structure of arrays without any copy of the text
+class EditScript {
+
+    std::vector<HunkKind> kinds;
+    std::vector<size_t> firstStarts;
+    std::vector<size_t> firstCounts;
+    std::vector<size_t> secondStarts;
+    std::vector<size_t> secondCounts;
+
+public:
+    void clear() {
+        kinds.clear();
+        firstStarts.clear();
+        firstCounts.clear();
+        secondStarts.clear();
+        secondCounts.clear();
+    }
+
+    // Records a run of differences, joining it to the last hunk when it directly follows it
+    void addHunk(HunkKind kind, size_t firstStart, size_t firstCount, size_t secondStart, size_t secondCount) {
+
+        if (!kinds.empty() && kinds.back() == kind
+            && firstStarts.back() + firstCounts.back() == firstStart
+            && secondStarts.back() + secondCounts.back() == secondStart) {
+            firstCounts.back() += firstCount;
+            secondCounts.back() += secondCount;
+            return;
         }
 
-        std::vector<std::string> lines;
-        std::string line;
-        while (std::getline(file, line)) {
-            // Trim whitespace and check if the line is empty
-            if (!line.empty()) {
-                lines.push_back(line);
+        kinds.push_back(kind);
+        firstStarts.push_back(firstStart);
+        firstCounts.push_back(firstCount);
+        secondStarts.push_back(secondStart);
+        secondCounts.push_back(secondCount);
+    }
+
+    // Records a differing line pair at the given line indexes
+    void addLine(HunkKind kind, size_t firstLine, bool inFirst, size_t secondLine, bool inSecond) {
+        addHunk(kind, firstLine, inFirst ? 1 : 0, secondLine, inSecond ? 1 : 0);
+    }
+
+    size_t size() const { return kinds.size(); }
+    bool empty() const { return kinds.empty(); }
+
+    Hunk operator[](size_t hunkIndex) const {
+        return { kinds[hunkIndex], firstStarts[hunkIndex], firstCounts[hunkIndex], secondStarts[hunkIndex], secondCounts[hunkIndex] };
+    }
+};
+
+// Comparison options passed in from the exported API, combined as bit flags
+enum ComparisonOption : unsigned int {
+    CompareExact = 0,
+    CompareIgnoreWhitespace = 1,    // Runs of whitespace collapse to one space, leading and trailing whitespace is ignored
+    CompareIgnoreCase = 2,          // ASCII letters compare case-insensitively
+    CompareNormalizeUnicode = 4,    // Smart quotes, dashes and no-break spaces compare equal to their ASCII forms
+    CompareBinary = 8               // Compare raw bytes in content-defined chunks instead of lines
+};
+
+// Normalizer policy, maps the bytes of a line to comparison units one at a time without copying the line
+// FoldCase and UnifyPunctuation are resolved at compile time, so each instantiation only contains the work it needs
+template <bool FoldCase, bool UnifyPunctuation>
+struct CharNormalizer {
+
+    // Consumes one character starting at pos and returns its comparison unit
+    static unsigned int next(const char*& pos, const char* end) {
+
+        unsigned char lead = static_cast<unsigned char>(*pos);
+
+        if constexpr (UnifyPunctuation) {
+
+            // Decode two and three byte UTF-8 sequences, anything malformed falls through as a single byte
+            if (lead == 0xC2 && end - pos >= 2 && static_cast<unsigned char>(pos[1]) == 0xA0) {
+                pos += 2;
+                return ' ';     // U+00A0 no-break space
+            }
+            if (lead == 0xE2 && end - pos >= 3 && static_cast<unsigned char>(pos[1]) == 0x80) {
+                unsigned char last = static_cast<unsigned char>(pos[2]);
+                if (last >= 0x98 && last <= 0x9B) { pos += 3; return '\''; }   // U+2018..U+201B single quotes
+                if (last >= 0x9C && last <= 0x9F) { pos += 3; return '"'; }    // U+201C..U+201F double quotes
+                if (last >= 0x90 && last <= 0x95) { pos += 3; return '-'; }    // U+2010..U+2015 hyphens and dashes
             }
         }
 
-        file.close();
-        return lines;
-    }*/
+        pos++;
+        if constexpr (FoldCase) {
+            if (lead >= 'A' && lead <= 'Z') return lead + ('a' - 'A');
+        }
+        return lead;
+    }
 
-    std::string getPath() { return path; }
-    std::string getName() { return name; }
-    std::string getExtension() { return format; }
+    static bool isSpace(unsigned int unit) {
+        return unit == ' ' || unit == '\t' || unit == '\r' || unit == '\v' || unit == '\f';
+    }
+};
+
+// Granularity policy where every character is significant
+struct CharacterGranularity {
+
+    template <class Normalizer>
+    class Cursor {
+
+        const char* pos;
+        const char* end;
 
+    public:
+        Cursor(const std::string& line) : pos(line.data()), end(line.data() + line.size()) {}
+
+        bool next(unsigned int& unit) {
+            if (pos == end) return false;
+            unit = Normalizer::next(pos, end);
+            return true;
+        }
+    };
 };
 
-// Represents a difference between two files
-class Difference {
+// Granularity policy where a line is a sequence of words, whitespace only separates them
+struct WordGranularity {
 
-    int lineNumber;
-    std::string firstFileContent;
-    std::string secondFileContent;
+    template <class Normalizer>
+    class Cursor {
 
-public:
-    Difference(int lineNumber, const std::string& firstFileContent, const std::string& secondFileContent) {
-        this->lineNumber = lineNumber;
-        this->firstFileContent = firstFileContent;
-        this->secondFileContent = secondFileContent;
-    }      
-
-    // Methods used to show the list of differences in terms of line number and the corresponding content
-    int getLineNumber() const { return lineNumber; }
-    const std::string& getFirstFileContent() const { return firstFileContent; }
-    const std::string& getSecondFileContent() const { return secondFileContent; }
+        const char* pos;
+        const char* end;
+        unsigned int held = 0;
+        bool hasHeld = false;
+
+        // Skips a run of whitespace and keeps the first unit after it, returns false if the line ends first
+        bool skipSpaces() {
+            while (pos != end) {
+                unsigned int unit = Normalizer::next(pos, end);
+                if (!Normalizer::isSpace(unit)) {
+                    held = unit;
+                    hasHeld = true;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    public:
+        Cursor(const std::string& line) : pos(line.data()), end(line.data() + line.size()) {
+            skipSpaces();
+        }
+
+        bool next(unsigned int& unit) {
+            if (hasHeld) {
+                unit = held;
+                hasHeld = false;
+                return true;
+            }
+            if (pos == end) return false;
+
+            unit = Normalizer::next(pos, end);
+            if (!Normalizer::isSpace(unit)) return true;
+
+            // A run of whitespace between two words becomes one space, trailing whitespace disappears
+            unit = ' ';
+            return skipSpaces();
+        }
+    };
 };
 
 // Responsible for comparing two input files
+// Lines are compared after normalization by the Normalizer and Granularity policies
+template <class Normalizer = CharNormalizer<false, false>, class Granularity = CharacterGranularity>
 class Comparator {
 
-    std::vector<Difference> differences;
+    using Cursor = typename Granularity::template Cursor<Normalizer>;
+
+    LineIndex firstIndex;
+    LineIndex secondIndex;
+    EditScript editScript;
+
+    // Exact comparison needs no normalization pass at all
+    static constexpr bool isExact = std::is_same<Normalizer, CharNormalizer<false, false>>::value
+        && std::is_same<Granularity, CharacterGranularity>::value;
+
+    static bool linesDiffer(const std::string& line1, const std::string& line2) {
+        if constexpr (isExact) {
+            return line1 != line2;
+        }
+        else {
+            return !sameNormalized(line1, line2);
+        }
+    }
+
+    // Walks both lines once in step and stops at the first differing unit
+    static bool sameNormalized(const std::string& line1, const std::string& line2) {
+        Cursor cursor1(line1);
+        Cursor cursor2(line2);
+        unsigned int unit1 = 0, unit2 = 0;
+        while (true) {
+            bool got1 = cursor1.next(unit1);
+            bool got2 = cursor2.next(unit2);
+            if (got1 != got2) return false;
+            if (!got1) return true;
+            if (unit1 != unit2) return false;
+        }
+    }
 
 public:
 
     void compareFilesContent(const std::string file1Path, const std::string file2Path, std::string& file1Str, std::string& file2Str) {
 
         // Open files
-        std::ifstream file1(file1Path);
-        std::ifstream file2(file2Path);
-        if (!file1) throw std::runtime_error("File not found: " + file1Path);
-        if (!file2) throw std::runtime_error("File not found: " + file2Path);
+        FileLineReader file1(file1Path);
+        FileLineReader file2(file2Path);
+        compareContent(file1, file2, file1Str, file2Str);
+    }
+
+    // Compares two line streams in lockstep, so converter output is consumed while it is being produced
+    // The content of both files is appended to file1Str and file2Str, which the line indexes refer to
+    void compareContent(LineReader& file1, LineReader& file2, std::string& file1Str, std::string& file2Str) {
 
         //Prepare content buffers and differences
-        std::ostringstream file1Content, file2Content;
-        differences.clear();
+        file1Str.clear();
+        file2Str.clear();
+        firstIndex = LineIndex();
+        secondIndex = LineIndex();
+        editScript.clear();
         std::string line1, line2;
-        int lineNumber = 0;
+        const std::string missingLine;
 
         while (true)
         {
-            bool gotLine1 = static_cast<bool>(std::getline(file1, line1));
-            bool gotLine2 = static_cast<bool>(std::getline(file2, line2));
-            lineNumber++;
+            bool gotLine1 = file1.nextLine(line1);
+            bool gotLine2 = file2.nextLine(line2);
 
             if (!gotLine1 && !gotLine2)
             {
                 break;
             }
 
-            std::string currentLine1 = gotLine1 ? line1 : "";
-            std::string currentLine2 = gotLine2 ? line2 : "";
+            const std::string& currentLine1 = gotLine1 ? line1 : missingLine;
+            const std::string& currentLine2 = gotLine2 ? line2 : missingLine;
 
             //Compare and store
-            if (currentLine1 != currentLine2) {
-                differences.emplace_back(lineNumber, currentLine1, currentLine2);
+            if (linesDiffer(currentLine1, currentLine2)) {
+                HunkKind kind = gotLine1 && gotLine2 ? HunkKind::Changed : (gotLine1 ? HunkKind::Removed : HunkKind::Added);
+                editScript.addLine(kind, firstIndex.lineCount(), gotLine1, secondIndex.lineCount(), gotLine2);
             }
 
-            if (gotLine1) file1Content << line1 << "\n";
-            if (gotLine2) file2Content << line2 << "\n";
+            if (gotLine1) firstIndex.append(file1Str, line1);
+            if (gotLine2) secondIndex.append(file2Str, line2);
         }
 
-        // Close the files
-        file1.close();
-        file2.close();
+    }
+
+    const EditScript& getEditScript() const { return editScript; }
+    const LineIndex& getFirstIndex() const { return firstIndex; }
+    const LineIndex& getSecondIndex() const { return secondIndex; }
+};
+
+// Piece of a file cut at a content-defined boundary
+struct Chunk {
+    std::uint64_t offset;
+    std::uint64_t length;
+    std::uint64_t hash;
+};
+
+// Splits a file into content-defined chunks with a gear rolling hash in the style of FastCDC
+// Boundaries depend only on nearby content, so an insertion or deletion only changes the chunks around it
+class ChunkReader {
+
+    static constexpr size_t minChunk = 2 * 1024;
+    static constexpr size_t averageChunk = 8 * 1024;
+    static constexpr size_t maxChunk = 64 * 1024;
+    static constexpr size_t bufferSize = 1024 * 1024;
+
+    // Normalized chunking, a stricter mask below the average size and a looser one above it
+    static constexpr std::uint64_t strictMask = 0x0000D9F003530000ull;     // 15 bits set
+    static constexpr std::uint64_t looseMask = 0x0000D90003530000ull;      // 11 bits set
+
+    std::ifstream file;
+    std::vector<char> buffer;
+    size_t bufferStart = 0;
+    size_t bufferEnd = 0;
+    std::uint64_t offset = 0;
+
+    static const std::uint64_t* gearTable() {
+        static const std::vector<std::uint64_t> table = [] {
+
+            // Fixed pseudo-random values from splitmix64, so boundaries are stable between runs
+            std::vector<std::uint64_t> values(256);
+            std::uint64_t state = 0x9E3779B97F4A7C15ull;
+            for (auto& value : values) {
+                std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                value = z ^ (z >> 31);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Keeps at least maxChunk bytes buffered unless the file ends first
+    void refill() {
+        if (bufferEnd - bufferStart >= maxChunk) return;
+        std::memmove(buffer.data(), buffer.data() + bufferStart, bufferEnd - bufferStart);
+        bufferEnd -= bufferStart;
+        bufferStart = 0;
+        file.read(buffer.data() + bufferEnd, buffer.size() - bufferEnd);
+        bufferEnd += static_cast<size_t>(file.gcount());
+    }
+
+    static std::uint64_t rotateLeft(std::uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static std::uint64_t mixWord(std::uint64_t hash, std::uint64_t word) {
+        word *= 0x87C37B91114253D5ull;
+        word = rotateLeft(word, 31);
+        word *= 0x4CF5AD432745937Full;
+        hash ^= word;
+        return rotateLeft(hash, 27) * 5 + 0x52DCE729;
+    }
 
-        file1Str = file1Content.str();
-        file2Str = file2Content.str();
+    // MurmurHash3-style mix over 8-byte words with its 64-bit finalizer, identifies the chunk content
+    // The rotations carry every input bit into the low bits before the next multiply, so no bit only reaches the top of the hash
+    static std::uint64_t hashBytes(const char* data, size_t size) {
+        std::uint64_t hash = size;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = mixWord(hash, word);
+        }
+        if (i < size) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, data + i, size - i);
+            hash = mixWord(hash, word);
+        }
+
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        return hash ^ (hash >> 33);
+    }
 
+public:
+    // A known file size smaller than the buffer shrinks it, which keeps snapshots of many small files cheap
+    ChunkReader(const std::string& path, std::uint64_t sizeHint = bufferSize)
+        : file(path, std::ios::binary), buffer(static_cast<size_t>(std::min<std::uint64_t>(bufferSize, std::max<std::uint64_t>(sizeHint + 1, maxChunk)))) {
+        if (!file) throw std::runtime_error("File not found: " + path);
     }
 
-    std::vector<Difference> getDifferences() { return differences; }
+    bool next(Chunk& chunk) {
+
+        refill();
+        size_t available = bufferEnd - bufferStart;
+        if (available == 0) return false;
+
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer.data() + bufferStart);
+        size_t length = available;
+
+        if (available > minChunk) {
+
+            // Boundaries are never placed before minChunk, so those bytes are skipped without hashing
+            const std::uint64_t* gear = gearTable();
+            size_t limit = std::min(available, maxChunk);
+            size_t normal = std::min(limit, averageChunk);
+            std::uint64_t fingerprint = 0;
+            size_t i = minChunk;
+            length = limit;
+
+            for (; i < normal; i++) {
+                fingerprint = (fingerprint << 1) + gear[data[i]];
+                if ((fingerprint & strictMask) == 0) { length = i + 1; break; }
+            }
+            if (i == normal) {
+                for (; i < limit; i++) {
+                    fingerprint = (fingerprint << 1) + gear[data[i]];
+                    if ((fingerprint & looseMask) == 0) { length = i + 1; break; }
+                }
+            }
+        }
+
+        chunk.offset = offset;
+        chunk.length = length;
+        chunk.hash = hashBytes(buffer.data() + bufferStart, length);
+        bufferStart += length;
+        offset += length;
+        return true;
+    }
 };
 
+// Compares two files byte by byte at chunk granularity and reports the changed byte ranges
+// Only a bounded window of chunk records is kept, so memory use does not grow with the file size
+class ByteComparator {
+
+    // Chunks looked ahead in each file to find where they match again, about 8 MB of data at the average chunk size
+    static constexpr size_t resyncWindow = 1024;
+
+    EditScript editScript;
+
+    static void fill(ChunkReader& reader, std::deque<Chunk>& chunks, size_t count) {
+        Chunk chunk;
+        while (chunks.size() < count && reader.next(chunk)) {
+            chunks.push_back(chunk);
+        }
+    }
+
+    static bool sameChunk(const Chunk& first, const Chunk& second) {
+        return first.hash == second.hash && first.length == second.length;
+    }
+
+    // Records the first firstCount and secondCount chunks of each window as one changed range
+    void addRange(std::deque<Chunk>& first, size_t firstCount, std::deque<Chunk>& second, size_t secondCount,
+        std::uint64_t firstOffset, std::uint64_t secondOffset) {
+
+        std::uint64_t firstLength = 0;
+        std::uint64_t secondLength = 0;
+        for (size_t i = 0; i < firstCount; i++) firstLength += first[i].length;
+        for (size_t i = 0; i < secondCount; i++) secondLength += second[i].length;
+        first.erase(first.begin(), first.begin() + firstCount);
+        second.erase(second.begin(), second.begin() + secondCount);
+
+        HunkKind kind = firstLength && secondLength ? HunkKind::Changed : (firstLength ? HunkKind::Removed : HunkKind::Added);
+        editScript.addHunk(kind, firstOffset, firstLength, secondOffset, secondLength);
+    }
+
+public:
+    void compareFiles(const std::string& file1Path, const std::string& file2Path) {
+
+        ChunkReader file1(file1Path);
+        ChunkReader file2(file2Path);
+        std::deque<Chunk> first;
+        std::deque<Chunk> second;
+        editScript.clear();
+
+        std::uint64_t firstOffset = 0;
+        std::uint64_t secondOffset = 0;
+
+        while (true) {
+            fill(file1, first, 1);
+            fill(file2, second, 1);
+            if (first.empty() && second.empty()) break;
+
+            // Identical chunks, move on
+            if (!first.empty() && !second.empty() && sameChunk(first.front(), second.front())) {
+                firstOffset += first.front().length;
+                secondOffset += second.front().length;
+                first.pop_front();
+                second.pop_front();
+                continue;
+            }
+
+            // Look ahead for the nearest pair of matching chunks, minimizing the chunks skipped in both files
+            fill(file1, first, resyncWindow);
+            fill(file2, second, resyncWindow);
+
+            std::unordered_map<std::uint64_t, size_t> secondPositions;
+            for (size_t j = second.size(); j-- > 0;) {
+                secondPositions[second[j].hash] = j;
+            }
+
+            size_t bestFirst = first.size();
+            size_t bestSecond = second.size();
+            for (size_t i = 0; i < first.size() && i < bestFirst + bestSecond; i++) {
+                auto found = secondPositions.find(first[i].hash);
+                if (found != secondPositions.end() && sameChunk(first[i], second[found->second])
+                    && i + found->second < bestFirst + bestSecond) {
+                    bestFirst = i;
+                    bestSecond = found->second;
+                }
+            }
+
+            // Without a match the whole window counts as changed
+            std::uint64_t rangeFirstOffset = firstOffset;
+            std::uint64_t rangeSecondOffset = secondOffset;
+            for (size_t i = 0; i < bestFirst; i++) firstOffset += first[i].length;
+            for (size_t j = 0; j < bestSecond; j++) secondOffset += second[j].length;
+            addRange(first, bestFirst, second, bestSecond, rangeFirstOffset, rangeSecondOffset);
+        }
+    }
+
+    const EditScript& getEditScript() const { return editScript; }
+
+    // Files with null bytes or very long lines are not line-oriented, judged from the first 64 KB
+    static bool looksBinary(const std::string& path) {
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        std::vector<char> sample(64 * 1024);
+        file.read(sample.data(), sample.size());
+        size_t size = static_cast<size_t>(file.gcount());
+
+        size_t lineLength = 0;
+        size_t longestLine = 0;
+        for (size_t i = 0; i < size; i++) {
+            if (sample[i] == '\0') return true;
+            if (sample[i] == '\n') {
+                longestLine = std::max(longestLine, lineLength);
+                lineLength = 0;
+            }
+            else {
+                lineLength++;
+            }
+        }
+        longestLine = std::max(longestLine, lineLength);
+        return longestLine >= 16 * 1024;
+    }
+
+    // A file is compared by bytes if no converter claims it and it does not look like line-oriented text
+    // Converters are found by extension first, then by magic bytes, the same order ConverterRegistry::open uses
+    static bool shouldCompareBytes(const std::string& path, std::string extension, const ConverterRegistry& registry) {
+
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        // Plain text is read as it is on disk, so it can still turn out to be binary
+        if (extension != ".txt") {
+            if (registry.hasExtension(extension)) return false;
+            if (registry.matchesMagic(path)) return false;
+        }
+        return looksBinary(path);
+    }
+};
+
+// One file or directory in a snapshot, directories hold their children sorted by name
+struct SnapshotNode {
+    std::string name;
+    bool isDirectory = false;
+    std::uint64_t hash = 0;
+    std::uint64_t size = 0;
+    std::int64_t lastWriteTime = 0;
+    std::vector<std::uint64_t> chunkHashes;     // Only recorded for large files
+    std::vector<SnapshotNode> children;
+    bool unreadable = false;                    // A file that could not be read, or a directory holding one
+};
+
+// A difference found between two snapshots, the path is relative to the snapshot roots with "/" separators
+struct TreeChange {
+    HunkKind kind;
+    std::string relativePath;
+    size_t changedChunks;       // For large changed files, chunks of the second file that are not in the first
+    size_t totalChunks;
+    bool unreadable;            // Either file could not be read, so its content is unknown
+};
+
+// Merkle tree of a directory, every node's hash covers everything below it
+// Comparing two snapshots only descends into subtrees whose hashes differ
+class DirectorySnapshot {
+
+    static constexpr std::uint64_t largeFileSize = 1024 * 1024;
+    static constexpr char magic[4] = { 'T', 'F', 'M', 'S' };
+    static constexpr std::uint32_t formatVersion = 3;
+
+    SnapshotNode root;
+
+    static std::uint64_t combine(std::uint64_t hash, std::uint64_t value) {
+        hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+        hash = (hash ^ (hash >> 31)) * 0xBF58476D1CE4E5B9ull;
+        return hash ^ (hash >> 29);
+    }
+
+    static std::uint64_t hashName(const std::string& name) {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (char c : name) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Hashes a file through its content-defined chunks, large files keep the chunk hashes as well
+    static void hashFile(const std::filesystem::path& path, SnapshotNode& node) {
+
+        ChunkReader reader(path.string(), node.size);
+        Chunk chunk;
+        std::uint64_t hash = 0;
+        std::vector<std::uint64_t> chunkHashes;
+        while (reader.next(chunk)) {
+            hash = combine(hash, chunk.hash);
+            chunkHashes.push_back(chunk.hash);
+        }
+
+        node.hash = combine(hash, node.size);
+        if (node.size >= largeFileSize) node.chunkHashes = std::move(chunkHashes);
+    }
+
+    // A directory that could not be listed is unreadable itself, not through a file below it, and has nothing to walk
+    static bool isUnlisted(const SnapshotNode& node) {
+        return node.isDirectory && node.unreadable
+            && std::none_of(node.children.begin(), node.children.end(), [](const SnapshotNode& child) { return child.unreadable; });
+    }
+
+    static const SnapshotNode* findChild(const SnapshotNode* parent, const std::string& name) {
+        if (parent == nullptr || !parent->isDirectory) return nullptr;
+        auto found = std::lower_bound(parent->children.begin(), parent->children.end(), name,
+            [](const SnapshotNode& child, const std::string& key) { return child.name < key; });
+        return (found != parent->children.end() && found->name == name) ? &*found : nullptr;
+    }
+
+    // Builds the node for a directory, files whose size and modification time match the previous snapshot are not read again
+    static void buildDirectory(const std::filesystem::path& directory, const SnapshotNode* previous, SnapshotNode& node) {
+
+        node.isDirectory = true;
+        try {
+            for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+
+                // Symbolic links to directories are not followed, so a link cycle cannot recurse forever
+                if (entry.is_symlink() && entry.is_directory()) continue;
+
+                SnapshotNode child;
+                child.name = entry.path().filename().u8string();
+                const SnapshotNode* previousChild = findChild(previous, child.name);
+
+                if (entry.is_directory()) {
+                    buildDirectory(entry.path(), previousChild, child);
+                }
+                else if (entry.is_regular_file()) {
+                    try {
+                        child.size = entry.file_size();
+                        child.lastWriteTime = static_cast<std::int64_t>(entry.last_write_time().time_since_epoch().count());
+
+                        // An unreadable file is never reused, it is read again until it succeeds
+                        if (previousChild != nullptr && !previousChild->isDirectory && !previousChild->unreadable
+                            && previousChild->size == child.size && previousChild->lastWriteTime == child.lastWriteTime) {
+                            child.hash = previousChild->hash;
+                            child.chunkHashes = previousChild->chunkHashes;
+                        }
+                        else {
+                            hashFile(entry.path(), child);
+                        }
+                    }
+                    catch (const std::exception& ex) {
+
+                        // An unreadable file has no hash to compare, it is flagged and always reported as changed
+                        std::cerr << "Error reading file: " << ex.what() << std::endl;
+                        child.hash = 0;
+                        child.chunkHashes.clear();
+                        child.unreadable = true;
+                    }
+                }
+                else {
+                    continue;
+                }
+
+                node.unreadable = node.unreadable || child.unreadable;
+                node.children.push_back(std::move(child));
+            }
+        }
+        catch (const std::filesystem::filesystem_error& ex) {
+
+            // A directory that cannot be listed is flagged with no children, see isUnlisted
+            std::cerr << "Error reading directory: " << ex.what() << std::endl;
+            node.children.clear();
+            node.unreadable = true;
+        }
+
+        std::sort(node.children.begin(), node.children.end(),
+            [](const SnapshotNode& first, const SnapshotNode& second) { return first.name < second.name; });
+
+        std::uint64_t hash = 1;
+        for (const auto& child : node.children) {
+            hash = combine(hash, hashName(child.name));
+            hash = combine(hash, child.hash);
+            hash = combine(hash, child.isDirectory ? 1 : 0);
+        }
+        node.hash = hash;
+    }
+
+    // Variable-length integers keep the snapshot compact, most sizes and counts fit in one or two bytes
+    static void writeNumber(std::ostream& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out.put(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.put(static_cast<char>(value));
+    }
+
+    static std::uint64_t readNumber(std::istream& in) {
+        std::uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = in.get();
+            if (byte == EOF) throw std::runtime_error("Snapshot file is truncated");
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        throw std::runtime_error("Snapshot file is corrupt");
+    }
+
+    static void writeHash(std::ostream& out, std::uint64_t hash) {
+        for (int i = 0; i < 8; i++) out.put(static_cast<char>((hash >> (8 * i)) & 0xFF));
+    }
+
+    static std::uint64_t readHash(std::istream& in) {
+        char bytes[8];
+        if (!in.read(bytes, 8)) throw std::runtime_error("Snapshot file is truncated");
+        std::uint64_t hash = 0;
+        for (int i = 0; i < 8; i++) hash |= static_cast<std::uint64_t>(static_cast<unsigned char>(bytes[i])) << (8 * i);
+        return hash;
+    }
+
+    // Nodes are written depth first: name, type, unreadable flag, hash, then file metadata or the children
+    static void writeNode(std::ostream& out, const SnapshotNode& node) {
+        writeNumber(out, node.name.size());
+        out.write(node.name.data(), node.name.size());
+        out.put(node.isDirectory ? 'D' : 'F');
+        out.put(node.unreadable ? 1 : 0);
+        writeHash(out, node.hash);
+
+        if (node.isDirectory) {
+            writeNumber(out, node.children.size());
+            for (const auto& child : node.children) writeNode(out, child);
+        }
+        else {
+            writeNumber(out, node.size);
+            writeHash(out, static_cast<std::uint64_t>(node.lastWriteTime));
+            writeNumber(out, node.chunkHashes.size());
+            for (std::uint64_t chunkHash : node.chunkHashes) writeHash(out, chunkHash);
+        }
+    }
+
+    static void readNode(std::istream& in, SnapshotNode& node) {
+        std::uint64_t nameLength = readNumber(in);
+        if (nameLength > 4096) throw std::runtime_error("Snapshot file is corrupt");
+        node.name.resize(static_cast<size_t>(nameLength));
+        if (!in.read(&node.name[0], node.name.size())) throw std::runtime_error("Snapshot file is truncated");
+
+        int type = in.get();
+        if (type != 'D' && type != 'F') throw std::runtime_error("Snapshot file is corrupt");
+        node.isDirectory = type == 'D';
+        int flag = in.get();
+        if (flag != 0 && flag != 1) throw std::runtime_error("Snapshot file is corrupt");
+        node.unreadable = flag == 1;
+        node.hash = readHash(in);
+
+        if (node.isDirectory) {
+            std::uint64_t childCount = readNumber(in);
+            for (std::uint64_t i = 0; i < childCount; i++) {
+                node.children.emplace_back();
+                readNode(in, node.children.back());
+            }
+        }
+        else {
+            node.size = readNumber(in);
+            node.lastWriteTime = static_cast<std::int64_t>(readHash(in));
+            std::uint64_t chunkCount = readNumber(in);
+            for (std::uint64_t i = 0; i < chunkCount; i++) node.chunkHashes.push_back(readHash(in));
+        }
+    }
+
+    // Reports every file below a node that exists on one side only
+    static void addWhole(const SnapshotNode& node, const std::string& path, HunkKind kind, std::vector<TreeChange>& changes) {
+        if (node.isDirectory && !isUnlisted(node)) {
+            for (const auto& child : node.children) addWhole(child, joinPath(path, child.name), kind, changes);
+        }
+        else {
+            changes.push_back({ kind, path, 0, 0, node.unreadable });
+        }
+    }
+
+    static void diffNodes(const SnapshotNode& first, const SnapshotNode& second, const std::string& path, std::vector<TreeChange>& changes) {
+
+        // Equal hashes mean the whole subtree is unchanged, unless an unreadable file below hides its content
+        if (first.hash == second.hash && first.isDirectory == second.isDirectory && !first.unreadable && !second.unreadable) return;
+
+        if (first.isDirectory != second.isDirectory) {
+            addWhole(first, path, HunkKind::Removed, changes);
+            addWhole(second, path, HunkKind::Added, changes);
+            return;
+        }
+
+        // A directory that could not be listed on either side is reported as a whole
+        if (first.isDirectory && (isUnlisted(first) || isUnlisted(second))) {
+            changes.push_back({ HunkKind::Changed, path, 0, 0, true });
+            return;
+        }
+
+        if (!first.isDirectory) {
+
+            // For large files the chunk hashes tell how much of the file changed without reading it
+            // When only the second file is large there is nothing to match against, so all of its chunks count as changed
+            size_t changedChunks = second.chunkHashes.size();
+            if (!first.chunkHashes.empty() && !second.chunkHashes.empty()) {
+                changedChunks = 0;
+                std::unordered_map<std::uint64_t, size_t> firstChunks;
+                for (std::uint64_t chunkHash : first.chunkHashes) firstChunks[chunkHash]++;
+                for (std::uint64_t chunkHash : second.chunkHashes) {
+                    auto found = firstChunks.find(chunkHash);
+                    if (found == firstChunks.end() || found->second == 0) changedChunks++;
+                    else found->second--;
+                }
+            }
+            bool unreadable = first.unreadable || second.unreadable;
+            changes.push_back({ HunkKind::Changed, path, changedChunks, unreadable ? 0 : second.chunkHashes.size(), unreadable });
+            return;
+        }
+
+        // Both children lists are sorted by name, walk them together
+        auto firstChild = first.children.begin();
+        auto secondChild = second.children.begin();
+        while (firstChild != first.children.end() || secondChild != second.children.end()) {
+            if (secondChild == second.children.end() || (firstChild != first.children.end() && firstChild->name < secondChild->name)) {
+                addWhole(*firstChild, joinPath(path, firstChild->name), HunkKind::Removed, changes);
+                ++firstChild;
+            }
+            else if (firstChild == first.children.end() || secondChild->name < firstChild->name) {
+                addWhole(*secondChild, joinPath(path, secondChild->name), HunkKind::Added, changes);
+                ++secondChild;
+            }
+            else {
+                diffNodes(*firstChild, *secondChild, joinPath(path, firstChild->name), changes);
+                ++firstChild;
+                ++secondChild;
+            }
+        }
+    }
+
+    static std::string joinPath(const std::string& parent, const std::string& name) {
+        return parent.empty() ? name : parent + "/" + name;
+    }
+
+public:
+
+    // Snapshots a directory, passing the previous snapshot of the same directory avoids re-reading unchanged files
+    static DirectorySnapshot build(const std::string& directory, const DirectorySnapshot* previous) {
+        if (!std::filesystem::is_directory(directory)) throw std::runtime_error("Directory not found: " + directory);
+        DirectorySnapshot snapshot;
+        buildDirectory(directory, previous != nullptr ? &previous->root : nullptr, snapshot.root);
+
+        // Nothing can be compared when the top directory itself cannot be listed
+        if (isUnlisted(snapshot.root)) throw std::runtime_error("Failed to read directory: " + directory);
+        return snapshot;
+    }
+
+    void save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("Failed to save file: " + path);
+        file.write(magic, sizeof(magic));
+        writeNumber(file, formatVersion);
+        writeNode(file, root);
+        file.close();
+        if (!file) throw std::runtime_error("Failed to save file: " + path);
+    }
+
+    static DirectorySnapshot load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error("File not found: " + path);
+
+        char header[sizeof(magic)];
+        if (!file.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0 || readNumber(file) != formatVersion) {
+            throw std::runtime_error("Not a snapshot file: " + path);
+        }
+
+        DirectorySnapshot snapshot;
+        readNode(file, snapshot.root);
+        return snapshot;
+    }
+
+    std::uint64_t getHash() const { return root.hash; }
+
+    // Lists the files that differ between two snapshots, sorted by path
+    static std::vector<TreeChange> diff(const DirectorySnapshot& first, const DirectorySnapshot& second) {
+        std::vector<TreeChange> changes;
+        diffNodes(first.root, second.root, "", changes);
+        return changes;
+    }
+};
+
+// Identity of a file on disk, a change in size or modification time means its content may have changed
+struct FileStamp {
+
+    std::string canonicalPath;
+    std::uintmax_t size = 0;
+    std::filesystem::file_time_type lastWriteTime;
+
+    static FileStamp of(const std::string& path) {
+        FileStamp stamp;
+        stamp.canonicalPath = std::filesystem::canonical(path).string();
+        stamp.size = std::filesystem::file_size(stamp.canonicalPath);
+        stamp.lastWriteTime = std::filesystem::last_write_time(stamp.canonicalPath);
+        return stamp;
+    }
+
+    bool operator==(const FileStamp& other) const {
+        return canonicalPath == other.canonicalPath && size == other.size && lastWriteTime == other.lastWriteTime;
+    }
+};
+
+// Everything CompareFiles hands back to the caller for one pair of files
+struct ComparisonResult {
+    std::string file1Content;
+    std::string file2Content;
+    std::string differences;
+};
+
+// Bounded LRU cache of comparison results, shared by all callers in the process
+class ResultCache {
+
+    struct Entry {
+        std::string key;
+        FileStamp file1Stamp;
+        FileStamp file2Stamp;
+        std::shared_ptr<const ComparisonResult> result;
+        size_t bytes;
+    };
+
+    size_t maxEntries;
+    size_t maxBytes;
+    size_t totalBytes = 0;
+
+    // Most recently used entry first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::mutex mutex;
+
+    static std::string makeKey(const FileStamp& file1Stamp, const FileStamp& file2Stamp, unsigned int options) {
+        return file1Stamp.canonicalPath + '\0' + file2Stamp.canonicalPath + '\0' + std::to_string(options);
+    }
+
+    void erase(std::list<Entry>::iterator entry) {
+        totalBytes -= entry->bytes;
+        index.erase(entry->key);
+        entries.erase(entry);
+    }
+
+public:
+    ResultCache(size_t maxEntries, size_t maxBytes) : maxEntries(maxEntries), maxBytes(maxBytes) {}
+
+    // Returns the cached result, or nullptr if there is none or either file changed since it was stored
+    std::shared_ptr<const ComparisonResult> find(const FileStamp& file1Stamp, const FileStamp& file2Stamp, unsigned int options) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(makeKey(file1Stamp, file2Stamp, options));
+        if (found == index.end()) return nullptr;
+
+        auto entry = found->second;
+        if (!(entry->file1Stamp == file1Stamp) || !(entry->file2Stamp == file2Stamp)) {
+            erase(entry);
+            return nullptr;
+        }
+
+        entries.splice(entries.begin(), entries, entry);
+        return entry->result;
+    }
+
+    // The stamps must be taken before the files are read, so a change during the comparison invalidates the entry
+    void store(const FileStamp& file1Stamp, const FileStamp& file2Stamp, unsigned int options, std::shared_ptr<const ComparisonResult> result) {
+
+        size_t bytes = result->file1Content.size() + result->file2Content.size() + result->differences.size();
+        if (bytes > maxBytes) return;
+
+        std::string key = makeKey(file1Stamp, file2Stamp, options);
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto found = index.find(key);
+        if (found != index.end()) erase(found->second);
+
+        entries.push_front({ key, file1Stamp, file2Stamp, std::move(result), bytes });
+        index[key] = entries.begin();
+        totalBytes += bytes;
+
+        // Evict least recently used entries until both limits hold
+        while (entries.size() > maxEntries || totalBytes > maxBytes) {
+            erase(std::prev(entries.end()));
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        totalBytes = 0;
+    }
+
+    // Cache used by CompareFiles, up to 32 results and 256 MB of text
+    static ResultCache& shared() {
+        static ResultCache cache(32, 256 * 1024 * 1024);
+        return cache;
+    }
+};
+
+// Writes a ZIP archive entry by entry, entries are stored uncompressed and their CRC and sizes are
+// patched into the local header once the data is written, so content can be streamed without buffering
+class ZipWriter {
+
+    struct EntryRecord {
+        std::string name;
+        std::uint32_t crc;
+        std::uint32_t size;
+        std::uint32_t headerOffset;
+    };
+
+    std::ofstream file;
+    std::string path;
+    std::vector<EntryRecord> entries;
+    std::uint32_t crc = 0;
+    std::uint64_t entrySize = 0;
+    std::uint64_t dataOffset = 0;
+    bool entryOpen = false;
+
+    // DOS date 1980-01-01 00:00, the packages carry no meaningful timestamps
+    static constexpr std::uint16_t dosTime = 0;
+    static constexpr std::uint16_t dosDate = (0 << 9) | (1 << 5) | 1;
+
+    static const std::uint32_t* crcTable() {
+        static const std::vector<std::uint32_t> table = [] {
+            std::vector<std::uint32_t> values(256);
+            for (std::uint32_t n = 0; n < 256; n++) {
+                std::uint32_t c = n;
+                for (int bit = 0; bit < 8; bit++) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                values[n] = c;
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    void put16(std::uint16_t value) {
+        char bytes[2] = { static_cast<char>(value & 0xFF), static_cast<char>(value >> 8) };
+        file.write(bytes, 2);
+    }
+
+    void put32(std::uint32_t value) {
+        put16(static_cast<std::uint16_t>(value & 0xFFFF));
+        put16(static_cast<std::uint16_t>(value >> 16));
+    }
+
+    std::uint32_t position() {
+        std::uint64_t offset = static_cast<std::uint64_t>(file.tellp());
+        if (offset > 0xFFFFFFFFu) throw std::runtime_error("Output file too large for a ZIP package: " + path);
+        return static_cast<std::uint32_t>(offset);
+    }
+
+public:
+    ZipWriter(const std::string& path) : file(path, std::ios::binary | std::ios::trunc), path(path) {
+        if (!file) throw std::runtime_error("Failed to save file: " + path);
+    }
+
+    void beginEntry(const std::string& name) {
+
+        if (entryOpen) endEntry();
+        entries.push_back({ name, 0, 0, position() });
+
+        // Local file header, CRC and sizes are filled in by endEntry
+        put32(0x04034B50);
+        put16(10);                  // Version needed to extract
+        put16(0);                   // Flags
+        put16(0);                   // Method: stored
+        put16(dosTime);
+        put16(dosDate);
+        put32(0);                   // CRC-32
+        put32(0);                   // Compressed size
+        put32(0);                   // Uncompressed size
+        put16(static_cast<std::uint16_t>(name.size()));
+        put16(0);                   // Extra field length
+        file.write(name.data(), name.size());
+
+        crc = 0xFFFFFFFFu;
+        entrySize = 0;
+        dataOffset = position();
+        entryOpen = true;
+    }
+
+    void write(const char* data, size_t size) {
+        const std::uint32_t* table = crcTable();
+        for (size_t i = 0; i < size; i++) {
+            crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        entrySize += size;
+        file.write(data, size);
+    }
+
+    void write(std::string_view text) { write(text.data(), text.size()); }
+
+    void endEntry() {
+
+        if (dataOffset + entrySize > 0xFFFFFFFFu) throw std::runtime_error("Output file too large for a ZIP package: " + path);
+        EntryRecord& entry = entries.back();
+        entry.crc = crc ^ 0xFFFFFFFFu;
+        entry.size = static_cast<std::uint32_t>(entrySize);
+
+        // Patch CRC and sizes into the local header
+        std::uint32_t end = position();
+        file.seekp(entry.headerOffset + 14);
+        put32(entry.crc);
+        put32(entry.size);
+        put32(entry.size);
+        file.seekp(end);
+        entryOpen = false;
+    }
+
+    // Writes the central directory and closes the file
+    void finish() {
+
+        if (entryOpen) endEntry();
+        std::uint32_t directoryOffset = position();
+
+        for (const auto& entry : entries) {
+            put32(0x02014B50);
+            put16(20);              // Version made by
+            put16(10);              // Version needed to extract
+            put16(0);               // Flags
+            put16(0);               // Method: stored
+            put16(dosTime);
+            put16(dosDate);
+            put32(entry.crc);
+            put32(entry.size);
+            put32(entry.size);
+            put16(static_cast<std::uint16_t>(entry.name.size()));
+            put16(0);               // Extra field length
+            put16(0);               // Comment length
+            put16(0);               // Disk number
+            put16(0);               // Internal attributes
+            put32(0);               // External attributes
+            put32(entry.headerOffset);
+            file.write(entry.name.data(), entry.name.size());
+        }
+
+        std::uint32_t directorySize = position() - directoryOffset;
+
+        // End of central directory record
+        put32(0x06054B50);
+        put16(0);
+        put16(0);
+        put16(static_cast<std::uint16_t>(entries.size()));
+        put16(static_cast<std::uint16_t>(entries.size()));
+        put32(directorySize);
+        put32(directoryOffset);
+        put16(0);
+
+        file.close();
+        if (!file) throw std::runtime_error("Failed to save file: " + path);
+    }
+};
+
+// Represents the final merged file, written line by line in the format given by the output extension
+class OutputFile {
+
+public:
+    virtual ~OutputFile() = default;
+
+    virtual void writeLine(std::string_view line) = 0;
+    virtual void finish() = 0;
+
+    // .docx and .odt are written as document packages, anything else as plain text
+    static std::unique_ptr<OutputFile> create(const std::string& path);
+
+protected:
+
+    // Escapes XML markup characters, control characters other than tab are not allowed in XML 1.0 and are dropped
+    static void appendEscaped(std::string& out, std::string_view text) {
+        for (char c : text) {
+            switch (c) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20 || c == '\t') out += c;
+                break;
+            }
+        }
+    }
+};
+
+// Plain text output, one line per row
+class TextOutputFile : public OutputFile {
+
+    std::ofstream file;
+    std::string path;
+
+public:
+    TextOutputFile(const std::string& path) : file(path, std::ios::binary | std::ios::trunc), path(path) {
+        if (!file) throw std::runtime_error("Failed to save file: " + path);
+    }
+
+    void writeLine(std::string_view line) override {
+        file.write(line.data(), line.size());
+        file.put('\n');
+    }
+
+    void finish() override {
+        file.close();
+        if (!file) throw std::runtime_error("Failed to save file: " + path);
+    }
+};
+
+// Minimal WordprocessingML package, every line becomes one paragraph
+class DocxOutputFile : public OutputFile {
+
+    ZipWriter zip;
+    std::string chunk;
+
+public:
+    DocxOutputFile(const std::string& path) : zip(path) {
+
+        zip.beginEntry("[Content_Types].xml");
+        zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+            "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+            "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+            "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+            "<Override PartName=\"/word/document.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.wordprocessingml.document.main+xml\"/>"
+            "</Types>");
+
+        zip.beginEntry("_rels/.rels");
+        zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+            "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+            "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument\" Target=\"word/document.xml\"/>"
+            "</Relationships>");
+
+        // The document part stays open while lines are streamed into it
+        zip.beginEntry("word/document.xml");
+        zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+            "<w:document xmlns:w=\"http://schemas.openxmlformats.org/wordprocessingml/2006/main\"><w:body>");
+    }
+
+    void writeLine(std::string_view line) override {
+
+        chunk.clear();
+        chunk += "<w:p><w:r><w:t xml:space=\"preserve\">";
+
+        // Tabs are separate run elements in WordprocessingML
+        size_t start = 0;
+        size_t tab;
+        while ((tab = line.find('\t', start)) != std::string_view::npos) {
+            appendEscaped(chunk, line.substr(start, tab - start));
+            chunk += "</w:t><w:tab/><w:t xml:space=\"preserve\">";
+            start = tab + 1;
+        }
+        appendEscaped(chunk, line.substr(start));
+
+        chunk += "</w:t></w:r></w:p>";
+        zip.write(chunk);
+    }
+
+    void finish() override {
+        zip.write("<w:sectPr/></w:body></w:document>");
+        zip.finish();
+    }
+};
+
+// Minimal OpenDocument text package, every line becomes one paragraph
+class OdtOutputFile : public OutputFile {
+
+    ZipWriter zip;
+    std::string chunk;
+
+public:
+    OdtOutputFile(const std::string& path) : zip(path) {
+
+        // The mimetype entry must come first and uncompressed, readers identify the package by it
+        zip.beginEntry("mimetype");
+        zip.write("application/vnd.oasis.opendocument.text");
+
+        zip.beginEntry("META-INF/manifest.xml");
+        zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<manifest:manifest xmlns:manifest=\"urn:oasis:names:tc:opendocument:xmlns:manifest:1.0\" manifest:version=\"1.2\">"
+            "<manifest:file-entry manifest:full-path=\"/\" manifest:version=\"1.2\" manifest:media-type=\"application/vnd.oasis.opendocument.text\"/>"
+            "<manifest:file-entry manifest:full-path=\"content.xml\" manifest:media-type=\"text/xml\"/>"
+            "</manifest:manifest>");
+
+        // The content part stays open while lines are streamed into it
+        zip.beginEntry("content.xml");
+        zip.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<office:document-content xmlns:office=\"urn:oasis:names:tc:opendocument:xmlns:office:1.0\" "
+            "xmlns:text=\"urn:oasis:names:tc:opendocument:xmlns:text:1.0\" office:version=\"1.2\">"
+            "<office:body><office:text>");
+    }
+
+    void writeLine(std::string_view line) override {
+
+        chunk.clear();
+        chunk += "<text:p>";
+
+        // ODF collapses whitespace, so tabs and repeated or leading spaces need their own elements
+        size_t i = 0;
+        while (i < line.size()) {
+            if (line[i] == '\t') {
+                chunk += "<text:tab/>";
+                i++;
+            }
+            else if (line[i] == ' ') {
+                size_t run = line.find_first_not_of(' ', i);
+                size_t count = (run == std::string_view::npos ? line.size() : run) - i;
+                size_t literal = (i == 0) ? 0 : 1;
+                if (literal) chunk += ' ';
+                if (count > literal) chunk += "<text:s text:c=\"" + std::to_string(count - literal) + "\"/>";
+                i += count;
+            }
+            else {
+                size_t next = line.find_first_of(" \t", i);
+                if (next == std::string_view::npos) next = line.size();
+                appendEscaped(chunk, line.substr(i, next - i));
+                i = next;
+            }
+        }
+
+        chunk += "</text:p>";
+        zip.write(chunk);
+    }
+
+    void finish() override {
+        zip.write("</office:text></office:body></office:document-content>");
+        zip.finish();
+    }
+};
+
+inline std::unique_ptr<OutputFile> OutputFile::create(const std::string& path) {
+
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    if (extension == ".docx") return std::unique_ptr<OutputFile>(new DocxOutputFile(path));
+    if (extension == ".odt") return std::unique_ptr<OutputFile>(new OdtOutputFile(path));
+    return std::unique_ptr<OutputFile>(new TextOutputFile(path));
+}
+
 // Handles merging of two files
 //class Merger {
 //
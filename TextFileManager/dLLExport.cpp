@@ -120,6 +120,95 @@
 //}
 
 
+// Copies a string into a buffer the caller releases with FreeMemory
+static char* copyToCString(const std::string& text) {
+    char* buffer = new char[text.size() + 1];
+    std::copy(text.begin(), text.end(), buffer);
+    buffer[text.size()] = '\0';
+    return buffer;
+}
+
+
+// Runs one comparator instantiation and formats its differences
+template <class Normalizer, class Granularity>
+static void runComparison(LineReader& file1Reader, LineReader& file2Reader, ComparisonResult& result) {
+
+    Comparator<Normalizer, Granularity> comparator;
+    comparator.compareContent(file1Reader, file2Reader, result.file1Content, result.file2Content);
+
+    //Store differences, one line per differing line pair
+    const EditScript& editScript = comparator.getEditScript();
+    const LineIndex& firstIndex = comparator.getFirstIndex();
+    const LineIndex& secondIndex = comparator.getSecondIndex();
+    std::string& diffStr = result.differences;
+    diffStr.clear();
+
+    for (size_t hunkIndex = 0; hunkIndex < editScript.size(); hunkIndex++) {
+        Hunk hunk = editScript[hunkIndex];
+
+        // Lines are compared by position, so both files share the line number
+        // Added hunks are past the end of file1 and only have a start in file2
+        size_t lineStart = hunk.kind == HunkKind::Added ? hunk.secondStart : hunk.firstStart;
+        size_t lineCount = std::max(hunk.firstCount, hunk.secondCount);
+        for (size_t offset = 0; offset < lineCount; offset++) {
+            diffStr += "Line ";
+            diffStr += std::to_string(lineStart + offset + 1);
+            diffStr += ": File1 -> ";
+            if (offset < hunk.firstCount) diffStr += firstIndex.line(result.file1Content, hunk.firstStart + offset);
+            diffStr += ", File2 -> ";
+            if (offset < hunk.secondCount) diffStr += secondIndex.line(result.file2Content, hunk.secondStart + offset);
+            diffStr += "\n";
+        }
+    }
+}
+
+template <class Granularity>
+static void compareWithNormalizer(unsigned int options, LineReader& file1Reader, LineReader& file2Reader, ComparisonResult& result) {
+
+    switch (options & (CompareIgnoreCase | CompareNormalizeUnicode)) {
+    case CompareIgnoreCase:
+        runComparison<CharNormalizer<true, false>, Granularity>(file1Reader, file2Reader, result);
+        break;
+    case CompareNormalizeUnicode:
+        runComparison<CharNormalizer<false, true>, Granularity>(file1Reader, file2Reader, result);
+        break;
+    case CompareIgnoreCase | CompareNormalizeUnicode:
+        runComparison<CharNormalizer<true, true>, Granularity>(file1Reader, file2Reader, result);
+        break;
+    default:
+        runComparison<CharNormalizer<false, false>, Granularity>(file1Reader, file2Reader, result);
+        break;
+    }
+}
+
+// Compares raw bytes by content-defined chunks and lists the changed byte ranges, file content is not returned
+static void compareBytes(const std::string& file1Path, const std::string& file2Path, ComparisonResult& result) {
+
+    ByteComparator comparator;
+    comparator.compareFiles(file1Path, file2Path);
+
+    const EditScript& editScript = comparator.getEditScript();
+    std::string& diffStr = result.differences;
+    diffStr.clear();
+
+    for (size_t hunkIndex = 0; hunkIndex < editScript.size(); hunkIndex++) {
+        Hunk hunk = editScript[hunkIndex];
+        diffStr += "Bytes at " + std::to_string(hunk.firstStart) + " / " + std::to_string(hunk.secondStart);
+        diffStr += ": File1 -> " + std::to_string(hunk.firstCount) + " bytes";
+        diffStr += ", File2 -> " + std::to_string(hunk.secondCount) + " bytes\n";
+    }
+}
+
+// Picks the comparator instantiation for the options once per comparison, so no option is checked per line
+static void compareWithOptions(unsigned int options, LineReader& file1Reader, LineReader& file2Reader, ComparisonResult& result) {
+
+    if (options & CompareIgnoreWhitespace)
+        compareWithNormalizer<WordGranularity>(options, file1Reader, file2Reader, result);
+    else
+        compareWithNormalizer<CharacterGranularity>(options, file1Reader, file2Reader, result);
+}
+
+
 extern "C" {
 
 
@@ -130,73 +219,140 @@ extern "C" {
     };
 
 
-    __declspec(dllexport) FileComparisonResult CompareFiles(const char* file1Path, const char* file2Path) {
+    // Compares two files, options is a combination of ComparisonOption flags
+    __declspec(dllexport) FileComparisonResult CompareFilesWithOptions(const char* file1Path, const char* file2Path, unsigned int options) {
 
         FileComparisonResult result;
-        std::string file1Str, file2Str;
-        std::string file1ConvertedPath, file2ConvertedPath;
-        bool isFile1Converted = false;
-        bool isFile2Converted = false;
         File firstFile(file1Path);
         File secondFile(file2Path);
-        std::string outputDir = std::filesystem::current_path().string();
 
         try {
 
-            // Convert file1
-            file1ConvertedPath = firstFile.getPath();
-            if (firstFile.getExtension() != ".txt") {
-                file1ConvertedPath = firstFile.convertToTxt(file1ConvertedPath, outputDir);
-                isFile1Converted = true;
-            }
+            // Repeated comparisons of unchanged files are answered from the cache
+            FileStamp file1Stamp = FileStamp::of(firstFile.getPath());
+            FileStamp file2Stamp = FileStamp::of(secondFile.getPath());
+            std::shared_ptr<const ComparisonResult> comparison = ResultCache::shared().find(file1Stamp, file2Stamp, options);
 
-            // Convert file2
-            file2ConvertedPath = secondFile.getPath();
-            if (secondFile.getExtension() != ".txt") {
-                file2ConvertedPath = secondFile.convertToTxt(file2ConvertedPath, outputDir);
-                isFile2Converted = true;
-            }
+            if (!comparison) {
 
-            Comparator comparator;
-            comparator.compareFilesContent(file1ConvertedPath, file2ConvertedPath, file1Str, file2Str);
+                const ConverterRegistry& registry = ConverterRegistry::defaultRegistry();
+                auto computed = std::make_shared<ComparisonResult>();
 
-            result.file1ReturnContent = new char[file1Str.size() + 1];
-            std::copy(file1Str.begin(), file1Str.end(), result.file1ReturnContent);
-            result.file1ReturnContent[file1Str.size()] = '\0';
+                // Binary and other non-line-oriented files are compared by content-defined chunks, on request or when detected
+                if ((options & CompareBinary) || ByteComparator::shouldCompareBytes(firstFile.getPath(), firstFile.getExtension(), registry)
+                    || ByteComparator::shouldCompareBytes(secondFile.getPath(), secondFile.getExtension(), registry)) {
+                    compareBytes(firstFile.getPath(), secondFile.getPath(), *computed);
+                }
+                else {
 
-            result.file2ReturnContent = new char[file2Str.size() + 1];
-            std::copy(file2Str.begin(), file2Str.end(), result.file2ReturnContent);
-            result.file2ReturnContent[file2Str.size()] = '\0';
+                    // Each input is read through the converter registered for its format, converter output is streamed
+                    // through a pipe in memory, so parallel comparisons never share a file on disk
+                    std::unique_ptr<LineReader> file1Reader = registry.open(firstFile.getPath(), firstFile.getExtension());
+                    std::unique_ptr<LineReader> file2Reader = registry.open(secondFile.getPath(), secondFile.getExtension());
+                    compareWithOptions(options, *file1Reader, *file2Reader, *computed);
+                }
 
-            //Store differences
-            std::ostringstream diffStream;
-            for (const auto& diff : comparator.getDifferences()) {
-                diffStream << "Line " << diff.getLineNumber()
-                    << ": File1 -> " << diff.getFirstFileContent()
-                    << ", File2 -> " << diff.getSecondFileContent() << "\n";
+                ResultCache::shared().store(file1Stamp, file2Stamp, options, computed);
+                comparison = computed;
             }
 
-            std::string diffStr = diffStream.str();
-            result.differences = new char[diffStr.size() + 1];
-            std::copy(diffStr.begin(), diffStr.end(), result.differences);
-            result.differences[diffStr.size()] = '\0';
-
-            //Cleanup temporary files
-            if (isFile1Converted) firstFile.deleteTemporaryFile(file1ConvertedPath);
-            if (isFile2Converted) secondFile.deleteTemporaryFile(file2ConvertedPath);
+            result.file1ReturnContent = copyToCString(comparison->file1Content);
+            result.file2ReturnContent = copyToCString(comparison->file2Content);
+            result.differences = copyToCString(comparison->differences);
 
             return result;
 
         }
         catch (const std::exception& ex) {
-            // Cleanup on error
-            if (isFile1Converted) firstFile.deleteTemporaryFile(file1ConvertedPath);
-            if (isFile2Converted) secondFile.deleteTemporaryFile(file2ConvertedPath);
             std::cerr << "Error: " << ex.what() << std::endl;
             return {};
         }
     }
 
+    // Exact comparison, kept for callers without options
+    __declspec(dllexport) FileComparisonResult CompareFiles(const char* file1Path, const char* file2Path) {
+        return CompareFilesWithOptions(file1Path, file2Path, CompareExact);
+    }
+
+    // Drops all cached comparison results
+    __declspec(dllexport) void ClearComparisonCache() {
+        ResultCache::shared().clear();
+    }
+
+    // Compares two directory trees through Merkle snapshots and lists the files that differ, one per line as
+    // "Changed: path", "Added: path" (only in directory2) or "Removed: path" (only in directory1)
+    // Files that could not be read are always listed, marked " (unreadable)"
+    // Snapshot paths may be null, otherwise the previous snapshots are reused for unchanged files and then updated
+    // Returns nullptr on error, the result is released with FreeMemory
+    __declspec(dllexport) char* CompareDirectories(const char* directory1, const char* directory2, const char* snapshot1Path, const char* snapshot2Path) {
+
+        try {
+            // Snapshot of one side, starting from its previous snapshot when there is a usable one
+            auto snapshotOf = [](const char* directory, const char* snapshotPath) {
+                std::unique_ptr<DirectorySnapshot> previous;
+                if (snapshotPath != nullptr && std::filesystem::exists(snapshotPath)) {
+                    try {
+                        previous.reset(new DirectorySnapshot(DirectorySnapshot::load(snapshotPath)));
+                    }
+                    catch (const std::exception& ex) {
+                        std::cerr << "Ignoring previous snapshot: " << ex.what() << std::endl;
+                    }
+                }
+
+                DirectorySnapshot snapshot = DirectorySnapshot::build(directory, previous.get());
+                if (snapshotPath != nullptr) snapshot.save(snapshotPath);
+                return snapshot;
+            };
+
+            DirectorySnapshot firstSnapshot = snapshotOf(directory1, snapshot1Path);
+            DirectorySnapshot secondSnapshot = snapshotOf(directory2, snapshot2Path);
+
+            std::string changesStr;
+            for (const auto& change : DirectorySnapshot::diff(firstSnapshot, secondSnapshot)) {
+                changesStr += change.kind == HunkKind::Changed ? "Changed: " : (change.kind == HunkKind::Added ? "Added: " : "Removed: ");
+                changesStr += change.relativePath;
+                if (change.unreadable) {
+                    changesStr += " (unreadable)";
+                }
+                else if (change.totalChunks > 0) {
+                    changesStr += " (" + std::to_string(change.changedChunks) + " of " + std::to_string(change.totalChunks) + " chunks changed)";
+                }
+                changesStr += "\n";
+            }
+
+            return copyToCString(changesStr);
+        }
+        catch (const std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return nullptr;
+        }
+    }
+
+    // Saves merged content, lines separated by "\n", as .docx, .odt or plain text depending on the output extension
+    // Returns true if the file was written
+    __declspec(dllexport) bool SaveOutputFile(const char* outputPath, const char* mergedContent) {
+
+        try {
+            std::unique_ptr<OutputFile> output = OutputFile::create(outputPath);
+
+            std::string_view content(mergedContent);
+            size_t start = 0;
+            while (start < content.size()) {
+                size_t newline = content.find('\n', start);
+                if (newline == std::string_view::npos) newline = content.size();
+                output->writeLine(content.substr(start, newline - start));
+                start = newline + 1;
+            }
+
+            output->finish();
+            return true;
+        }
+        catch (const std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return false;
+        }
+    }
+
     // Function to free the memory allocated for the result string
     __declspec(dllexport) void FreeMemory(char* ptr) {
         if (ptr != nullptr) {
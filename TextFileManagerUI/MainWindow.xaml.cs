@@ -28,10 +28,27 @@ namespace TextFileManagerUI
         [DllImport(TextFileManagerDLL, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern FileComparisonResult CompareFiles(string file1Path, string file2Path);
 
+        // Comparison with option flags, matching ComparisonOption in the C++ library
+        [DllImport(TextFileManagerDLL, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern FileComparisonResult CompareFilesWithOptions(string file1Path, string file2Path, uint options);
+
+        private const uint CompareIgnoreWhitespace = 1;
+        private const uint CompareIgnoreCase = 2;
+        private const uint CompareNormalizeUnicode = 4;
+        private const uint CompareBinary = 8;
+
+        // Write merged lines as a .docx or .odt package, the content is passed as UTF-8
+        [DllImport(TextFileManagerDLL, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static extern bool SaveOutputFile(string outputPath, [MarshalAs(UnmanagedType.LPUTF8Str)] string mergedContent);
+
         // Free the allocated memory for the result string (called after using it)
         [DllImport(TextFileManagerDLL, CallingConvention = CallingConvention.Cdecl)]
         public static extern void FreeMemory(IntPtr ptr);
 
+        // File formats registered with the converters in the C++ library
+        private static readonly string[] SupportedFormats = { ".txt", ".docx", ".odt", ".rtf", ".html", ".htm", ".md" };
+
         // Disable save output button by default
         private bool isComparisonDone = false;
 
@@ -56,7 +73,7 @@ namespace TextFileManagerUI
         {
             OpenFileDialog fileDialog = new OpenFileDialog
             {
-                Filter = "All Files|*.*|Text Files|*.txt|Word Documents|*.docx|OpenDocument Text|*.odt",
+                Filter = "All Files|*.*|Text Files|*.txt|Word Documents|*.docx|OpenDocument Text|*.odt|Rich Text|*.rtf|Web Pages|*.html;*.htm|Markdown|*.md",
                 Title = "Select your first file"
             };
 
@@ -77,7 +94,7 @@ namespace TextFileManagerUI
         {
             OpenFileDialog fileDialog = new OpenFileDialog
             {
-                Filter = "All Files|*.*|Text Files|*.txt|Word Documents|*.docx|OpenDocument Text|*.odt",
+                Filter = "All Files|*.*|Text Files|*.txt|Word Documents|*.docx|OpenDocument Text|*.odt|Rich Text|*.rtf|Web Pages|*.html;*.htm|Markdown|*.md",
                 Title = "Select your second file"
             };
 
@@ -130,18 +147,19 @@ namespace TextFileManagerUI
                 return;
             }
 
-            // Check if either file is not a .txt file
-            if (System.IO.Path.GetExtension(file1Path).ToLower() != ".txt" || System.IO.Path.GetExtension(file2Path).ToLower() != ".txt")
+            // Check if either file is not a .txt file, binary comparison accepts any file
+            bool compareBinary = BinaryOption.IsChecked == true;
+            if (!compareBinary && (System.IO.Path.GetExtension(file1Path).ToLower() != ".txt" || System.IO.Path.GetExtension(file2Path).ToLower() != ".txt"))
             {
                 // Check if the file formats are supported
-                if (System.IO.Path.GetExtension(file1Path).ToLower() != ".txt" && System.IO.Path.GetExtension(file1Path).ToLower() != ".docx" && System.IO.Path.GetExtension(file1Path).ToLower() != ".odt")
+                if (!SupportedFormats.Contains(System.IO.Path.GetExtension(file1Path).ToLower()))
                 {
-                    MessageBox.Show("File 1 is not a valid file.\nThe following file formats are supported: .txt, .docx, .odt", "Error", MessageBoxButton.OK, MessageBoxImage.Error);
+                    MessageBox.Show("File 1 is not a valid file.\nThe following file formats are supported: " + string.Join(", ", SupportedFormats), "Error", MessageBoxButton.OK, MessageBoxImage.Error);
                     return;
                 }
-                if (System.IO.Path.GetExtension(file2Path).ToLower() != ".txt" && System.IO.Path.GetExtension(file2Path).ToLower() != ".docx" && System.IO.Path.GetExtension(file2Path).ToLower() != ".odt")
+                if (!SupportedFormats.Contains(System.IO.Path.GetExtension(file2Path).ToLower()))
                 {
-                    MessageBox.Show("File 2 is not a valid file.\nThe following file formats are supported: .txt, .docx, .odt", "Error", MessageBoxButton.OK, MessageBoxImage.Error);
+                    MessageBox.Show("File 2 is not a valid file.\nThe following file formats are supported: " + string.Join(", ", SupportedFormats), "Error", MessageBoxButton.OK, MessageBoxImage.Error);
                     return;
                 }
 
@@ -149,7 +167,7 @@ namespace TextFileManagerUI
                 if (!IsPandocInstalled())
                 {
                     MessageBox.Show(
-                        "Pandoc is not installed on this system. Please install Pandoc to enable file conversion from .docx or .odt to .txt.",
+                        "Pandoc is not installed on this system. Please install Pandoc to enable file conversion from .docx, .odt, .rtf, .html or .md to .txt.",
                         "Missing Dependency",
                         MessageBoxButton.OK,
                         MessageBoxImage.Warning);
@@ -157,11 +175,18 @@ namespace TextFileManagerUI
                 }
             }
 
+            // Collect the selected comparison options
+            uint options = 0;
+            if (IgnoreWhitespaceOption.IsChecked == true) options |= CompareIgnoreWhitespace;
+            if (IgnoreCaseOption.IsChecked == true) options |= CompareIgnoreCase;
+            if (NormalizeUnicodeOption.IsChecked == true) options |= CompareNormalizeUnicode;
+            if (compareBinary) options |= CompareBinary;
+
             try
             {
                 // Call the function
                 // Run the file comparison asynchronously to prevent UI thread being freezed for large files comparison
-                var result = await Task.Run(() => CompareFiles(file1Path, file2Path));
+                var result = await Task.Run(() => CompareFilesWithOptions(file1Path, file2Path, options));
                 //FileComparisonResult result = CompareFiles(file1Path, file2Path);
 
                 // Use the content and differences as needed
@@ -180,11 +205,19 @@ namespace TextFileManagerUI
 
                     // Parse the differences and update the ObservableCollection
                     Differences.Clear();
+                    var byteRanges = new List<string>();
                     string[] diffLines = differences.Split('\n');
                     foreach (string line in diffLines)
                     {
                         if (!string.IsNullOrEmpty(line))
                         {
+                            // Binary comparisons report changed byte ranges instead of lines
+                            if (line.StartsWith("Bytes"))
+                            {
+                                byteRanges.Add(line);
+                                continue;
+                            }
+
                             var parts = line.Split(new[] { ": File1 -> ", ", File2 -> " }, StringSplitOptions.None);
                             if (parts.Length == 3)
                             {
@@ -200,6 +233,19 @@ namespace TextFileManagerUI
                         }
                     }
 
+                    // Binary files cannot be merged line by line, only report where they differ
+                    if (byteRanges.Count > 0 || (compareBinary && string.IsNullOrEmpty(differences)))
+                    {
+                        string summary = byteRanges.Count == 0
+                            ? "The files are identical."
+                            : $"The files differ in {byteRanges.Count} byte range(s):\n" + string.Join("\n", byteRanges.Take(20));
+                        isComparisonDone = false;
+                        SaveOutputButton.IsEnabled = false;
+                        ModifyFileButton.IsEnabled = false;
+                        MessageBox.Show(summary, "Binary Comparison", MessageBoxButton.OK, MessageBoxImage.Information);
+                        return;
+                    }
+
                     // Set the flag to true after comparison is done
                     isComparisonDone = true;
 
@@ -319,7 +365,16 @@ namespace TextFileManagerUI
                 {
                     // Save the merged content to the selected file
                     string filePath = saveFileDialog.FileName;
-                    File.WriteAllLines(filePath, outputLines);
+                    if (selectedFormat == ".docx" || selectedFormat == ".odt")
+                    {
+                        // Documents are written natively by the C++ library
+                        if (!SaveOutputFile(filePath, string.Join("\n", outputLines)))
+                            throw new IOException("The document could not be written.");
+                    }
+                    else
+                    {
+                        File.WriteAllLines(filePath, outputLines);
+                    }
                     lastSavedFilePath = filePath;  // Store the path of the saved file
                     MessageBox.Show("Output file saved successfully!", "Success", MessageBoxButton.OK, MessageBoxImage.Information);
                 }
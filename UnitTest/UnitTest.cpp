@@ -1,5 +1,13 @@
 #include "pch.h"
 #include <fstream>
+#include <thread>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <chrono>
+
+// Internal classes of the library, compiled into the test the same way dLLExport.cpp includes them
+#include "../TextFileManager/FileManager.cpp"
 
 
 namespace UnitTests {
@@ -15,6 +23,10 @@ namespace UnitTests {
 
         FileComparisonResult CompareFiles(const char* file1Path, const char* file2Path);
         void FreeMemory(char* ptr);
+        FileComparisonResult CompareFilesWithOptions(const char* file1Path, const char* file2Path, unsigned int options);
+        void ClearComparisonCache();
+        bool SaveOutputFile(const char* outputPath, const char* mergedContent);
+        char* CompareDirectories(const char* directory1, const char* directory2, const char* snapshot1Path, const char* snapshot2Path);
 
     }
 
@@ -99,4 +111,450 @@ namespace UnitTests {
     }
 
 
+    // Concurrency testing - Parallel comparisons of the same plain text content in one process should all see the sequential result
+    // Each thread compares its own copy of the files, so the result cache cannot answer for it and every comparison really runs
+    // Inputs needing conversion are not covered here, as that would make the test depend on Pandoc being installed
+    TEST(FileComparisonTests, ParallelTextComparisons_ShouldMatchSequentialResult) {
+
+        // Initialize the test data
+        const char* file1 = "UnitTestData/FT_DiffFile1.txt";
+        const char* file2 = "UnitTestData/FT_DiffFile2.txt";
+
+        // Reference result from a single call
+        FileComparisonResult expected = CompareFiles(file1, file2);
+        std::string expectedDifferences = expected.differences;
+        FreeMemory(expected.file1ReturnContent);
+        FreeMemory(expected.file2ReturnContent);
+        FreeMemory(expected.differences);
+
+        // Give every thread its own copy of the pair in a scratch directory
+        const int threadCount = 8;
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_ParallelTest";
+        std::filesystem::create_directories(directory);
+        std::vector<std::string> copies1, copies2;
+        for (int i = 0; i < threadCount; i++) {
+            copies1.push_back((directory / ("PT_File1_" + std::to_string(i) + ".txt")).string());
+            copies2.push_back((directory / ("PT_File2_" + std::to_string(i) + ".txt")).string());
+            std::filesystem::copy_file(file1, copies1[i], std::filesystem::copy_options::overwrite_existing);
+            std::filesystem::copy_file(file2, copies2[i], std::filesystem::copy_options::overwrite_existing);
+        }
+
+        // Run the comparisons from several threads at once
+        std::vector<std::string> actualDifferences(threadCount);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < threadCount; i++) {
+            threads.emplace_back([&, i]() {
+                FileComparisonResult result = CompareFiles(copies1[i].c_str(), copies2[i].c_str());
+                actualDifferences[i] = result.differences ? result.differences : "";
+                FreeMemory(result.file1ReturnContent);
+                FreeMemory(result.file2ReturnContent);
+                FreeMemory(result.differences);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        // Every thread should see exactly the sequential result
+        for (const auto& differences : actualDifferences) {
+            EXPECT_EQ(differences, expectedDifferences);
+        }
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Caching testing - A repeated comparison should pick up changes made to an input file in between
+    TEST(FileComparisonTests, RepeatedComparison_ShouldReflectFileChanges) {
+
+        // Initialize the test data in a scratch directory
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_CacheTest";
+        std::filesystem::create_directories(directory);
+        std::string file1 = (directory / "CT_File1.txt").string();
+        std::string file2 = (directory / "CT_File2.txt").string();
+        std::ofstream(file1) << "first line\nsecond line\n";
+        std::ofstream(file2) << "first line\nsecond line\n";
+        ClearComparisonCache();
+
+        // Identical files, the result is now cached
+        FileComparisonResult result = CompareFiles(file1.c_str(), file2.c_str());
+        EXPECT_STREQ(result.differences, "");
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        // Change the second file and move its modification time forward
+        std::ofstream(file2) << "first line\nchanged line\n";
+        std::filesystem::last_write_time(file2, std::filesystem::last_write_time(file2) + std::chrono::seconds(2));
+
+        // Expect the change to be detected instead of the cached result being reused
+        result = CompareFiles(file1.c_str(), file2.c_str());
+        EXPECT_STREQ(result.differences, "Line 2: File1 -> second line, File2 -> changed line\n");
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Functional testing - Comparison options should hide whitespace, case and smart quote differences
+    TEST(FileComparisonTests, ComparisonOptions_ShouldIgnoreSelectedDifferences) {
+
+        // Initialize the test data in a scratch directory
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_OptionsTest";
+        std::filesystem::create_directories(directory);
+        std::string file1 = (directory / "OT_File1.txt").string();
+        std::string file2 = (directory / "OT_File2.txt").string();
+        std::ofstream(file1) << "Hello  World  \n\xE2\x80\x9Cquoted\xE2\x80\x9D\n";
+        std::ofstream(file2) << "hello world\n\"quoted\"\n";
+
+        // Exact comparison reports both lines
+        FileComparisonResult result = CompareFilesWithOptions(file1.c_str(), file2.c_str(), 0);
+        EXPECT_NE(std::string(result.differences).find("Line 1:"), std::string::npos);
+        EXPECT_NE(std::string(result.differences).find("Line 2:"), std::string::npos);
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        // Ignore whitespace and case, the quotes still differ
+        result = CompareFilesWithOptions(file1.c_str(), file2.c_str(), 1 | 2);
+        EXPECT_EQ(std::string(result.differences).find("Line 1:"), std::string::npos);
+        EXPECT_NE(std::string(result.differences).find("Line 2:"), std::string::npos);
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        // All options together, expect no differences
+        result = CompareFilesWithOptions(file1.c_str(), file2.c_str(), 1 | 2 | 4);
+        EXPECT_STREQ(result.differences, "");
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Functional testing - Lines past the end of the shorter file keep their own line numbers across gaps
+    TEST(FileComparisonTests, LinesPastEndOfShorterFile_ShouldKeepTheirLineNumbers) {
+
+        // Initialize the test data in a scratch directory
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_LineNumberTest";
+        std::filesystem::create_directories(directory);
+        std::string shortFile = (directory / "LN_Short.txt").string();
+        std::string addedFile = (directory / "LN_Added.txt").string();
+        std::string removedFile = (directory / "LN_Removed.txt").string();
+        std::ofstream(shortFile) << "a\n";
+        std::ofstream(addedFile) << "a\nb\n\nc\n";
+        std::ofstream(removedFile) << "a\nb\n \nc\n";
+
+        // The empty third line matches the missing line and splits the added run
+        FileComparisonResult result = CompareFiles(shortFile.c_str(), addedFile.c_str());
+        EXPECT_STREQ(result.differences, "Line 2: File1 -> , File2 -> b\nLine 4: File1 -> , File2 -> c\n");
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        // Ignoring whitespace, the blank third line splits the removed run the same way
+        result = CompareFilesWithOptions(removedFile.c_str(), shortFile.c_str(), 1);
+        EXPECT_STREQ(result.differences, "Line 2: File1 -> b, File2 -> \nLine 4: File1 -> c, File2 -> \n");
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Functional testing - Saving as .docx and .odt should produce ZIP packages with the expected first entry
+    TEST(FileComparisonTests, SaveOutputFile_ShouldWriteDocumentPackages) {
+
+        // Initialize the output paths in a scratch directory
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_SaveTest";
+        std::filesystem::create_directories(directory);
+        std::string docxPath = (directory / "ST_Output.docx").string();
+        std::string odtPath = (directory / "ST_Output.odt").string();
+        const char* content = "First line\nSecond <line> & more\n";
+
+        EXPECT_TRUE(SaveOutputFile(docxPath.c_str(), content));
+        EXPECT_TRUE(SaveOutputFile(odtPath.c_str(), content));
+
+        // Read the start of each package
+        auto readHeader = [](const std::string& path) {
+            std::ifstream file(path, std::ios::binary);
+            std::string header(128, '\0');
+            file.read(&header[0], header.size());
+            header.resize(static_cast<size_t>(file.gcount()));
+            return header;
+        };
+
+        // Both are ZIP archives, the .docx starts with its content types and the .odt with its mimetype
+        std::string docxHeader = readHeader(docxPath);
+        std::string odtHeader = readHeader(odtPath);
+        EXPECT_EQ(docxHeader.substr(0, 4), std::string("PK\x03\x04", 4));
+        EXPECT_EQ(docxHeader.substr(30, 19), "[Content_Types].xml");
+        EXPECT_EQ(odtHeader.substr(0, 4), std::string("PK\x03\x04", 4));
+        EXPECT_EQ(odtHeader.substr(30, 47), "mimetypeapplication/vnd.oasis.opendocument.text");
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Functional testing - Files with null bytes should be compared as binary and report changed byte ranges
+    TEST(FileComparisonTests, BinaryFiles_ShouldReportChangedByteRanges) {
+
+        // Initialize the test data in a scratch directory, the second file has a few bytes inserted in the middle
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_BinaryTest";
+        std::filesystem::create_directories(directory);
+        std::string file1 = (directory / "BIN_File1.txt").string();
+        std::string file2 = (directory / "BIN_File2.txt").string();
+
+        std::string content;
+        unsigned int state = 12345;
+        for (int i = 0; i < 512 * 1024; i++) {
+            state = state * 1103515245 + 12345;
+            content += static_cast<char>(state >> 16);
+        }
+        content[100] = '\0';
+        std::string modified = content.substr(0, 200000) + "INSERTED" + content.substr(200000);
+        std::ofstream(file1, std::ios::binary) << content;
+        std::ofstream(file2, std::ios::binary) << modified;
+
+        FileComparisonResult result = CompareFiles(file1.c_str(), file2.c_str());
+
+        // Expect a single changed range, larger on the second side by the inserted bytes
+        std::istringstream diffStream(result.differences);
+        std::string line;
+        int ranges = 0;
+        while (std::getline(diffStream, line)) {
+            EXPECT_EQ(line.rfind("Bytes at ", 0), 0u);
+            ranges++;
+        }
+        EXPECT_EQ(ranges, 1);
+
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Functional testing - Files differing only in the high bit of two bytes should not be taken as identical
+    TEST(FileComparisonTests, BinaryFiles_ShouldDetectHighBitChanges) {
+
+        // Initialize the test data in a scratch directory, bytes 7 and 15 are the top bytes of the first two words
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_HighBitTest";
+        std::filesystem::create_directories(directory / "first");
+        std::filesystem::create_directories(directory / "second");
+        std::string file1 = (directory / "first" / "HB_Data.bin").string();
+        std::string file2 = (directory / "second" / "HB_Data.bin").string();
+
+        std::string content(4096, '\0');
+        for (size_t i = 0; i < content.size(); i++) content[i] = static_cast<char>(i * 7);
+        std::string modified = content;
+        modified[7] = static_cast<char>(modified[7] ^ 0x80);
+        modified[15] = static_cast<char>(modified[15] ^ 0x80);
+        std::ofstream(file1, std::ios::binary) << content;
+        std::ofstream(file2, std::ios::binary) << modified;
+
+        // The byte comparison reports the changed range
+        FileComparisonResult result = CompareFiles(file1.c_str(), file2.c_str());
+        EXPECT_EQ(std::string(result.differences).rfind("Bytes at ", 0), 0u);
+        FreeMemory(result.file1ReturnContent);
+        FreeMemory(result.file2ReturnContent);
+        FreeMemory(result.differences);
+
+        // The directory snapshots see the file as changed
+        std::string firstDirectory = (directory / "first").string();
+        std::string secondDirectory = (directory / "second").string();
+        char* changes = CompareDirectories(firstDirectory.c_str(), secondDirectory.c_str(), nullptr, nullptr);
+        ASSERT_NE(changes, nullptr);
+        EXPECT_STREQ(changes, "Changed: HB_Data.bin\n");
+        FreeMemory(changes);
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Functional testing - Directory comparison should list only the changed, added and removed files
+    TEST(FileComparisonTests, CompareDirectories_ShouldListOnlyChangedFiles) {
+
+        // Initialize two trees in a scratch directory, most files are identical
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_DirectoryTest";
+        std::filesystem::path tree1 = directory / "Tree1";
+        std::filesystem::path tree2 = directory / "Tree2";
+        for (const auto& tree : { tree1, tree2 }) {
+            std::filesystem::create_directories(tree / "same");
+            std::filesystem::create_directories(tree / "docs");
+            std::ofstream(tree / "same" / "DT_Same.txt") << "unchanged\n";
+            std::ofstream(tree / "docs" / "DT_Edited.txt") << "original\n";
+        }
+        std::ofstream(tree2 / "docs" / "DT_Edited.txt") << "edited\n";
+        std::ofstream(tree1 / "DT_Removed.txt") << "only in tree 1\n";
+        std::ofstream(tree2 / "DT_Added.txt") << "only in tree 2\n";
+
+        // A file that grows past the large file size has no chunks in tree 1 to match, so all of its chunks are changed
+        std::string grown;
+        unsigned int state = 12345;
+        for (int i = 0; i < 2 * 1024 * 1024; i++) {
+            state = state * 1103515245 + 12345;
+            grown += static_cast<char>(state >> 16);
+        }
+        std::ofstream(tree1 / "DT_Grown.bin") << "small\n";
+        std::ofstream(tree2 / "DT_Grown.bin", std::ios::binary) << grown;
+        size_t grownChunks = 0;
+        ChunkReader reader((tree2 / "DT_Grown.bin").string());
+        for (Chunk chunk; reader.next(chunk);) grownChunks++;
+        std::string grownCount = std::to_string(grownChunks);
+
+        std::string expected = "Added: DT_Added.txt\nChanged: DT_Grown.bin (" + grownCount + " of " + grownCount + " chunks changed)\n"
+            "Removed: DT_Removed.txt\nChanged: docs/DT_Edited.txt\n";
+        std::string snapshot1 = (directory / "Tree1.snapshot").string();
+        std::string snapshot2 = (directory / "Tree2.snapshot").string();
+
+        // First run writes the snapshots, the second run starts from them and should give the same answer
+        for (int run = 0; run < 2; run++) {
+            char* changes = CompareDirectories(tree1.string().c_str(), tree2.string().c_str(), snapshot1.c_str(), snapshot2.c_str());
+            ASSERT_NE(changes, nullptr);
+            EXPECT_EQ(std::string(changes), expected);
+            FreeMemory(changes);
+        }
+        EXPECT_TRUE(std::filesystem::exists(snapshot1));
+        EXPECT_TRUE(std::filesystem::exists(snapshot2));
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Line reader over an in-memory string, handed out in small chunks to exercise lines split across reads
+    class FakeChunkLineReader : public SplittingLineReader {
+
+        std::string content;
+        size_t position = 0;
+
+    protected:
+        size_t readChunk(char* data, size_t size) override {
+            size_t count = std::min<size_t>({ size, 3, content.size() - position });
+            std::copy(content.begin() + position, content.begin() + position + count, data);
+            position += count;
+            return count;
+        }
+
+        void finish() override { finishCalls++; }
+
+    public:
+        int finishCalls = 0;
+
+        FakeChunkLineReader(const std::string& content) : SplittingLineReader(4), content(content) {}
+    };
+
+    // Unit testing - Converter output should lose CR characters and blank lines, lines may span several reads
+    TEST(LineReaderTests, SplittingLineReader_ShouldStripCarriageReturnsAndBlankLines) {
+
+        FakeChunkLineReader reader("first line\r\n\r\n\nsecond\r\n  \r\nlast without newline");
+
+        std::vector<std::string> lines;
+        std::string line;
+        while (reader.nextLine(line)) {
+            lines.push_back(line);
+        }
+
+        // Whitespace-only lines are content and stay, only empty lines are dropped
+        std::vector<std::string> expected = { "first line", "second", "  ", "last without newline" };
+        EXPECT_EQ(lines, expected);
+        EXPECT_EQ(reader.finishCalls, 1);
+
+        // Reading past the end keeps returning false
+        EXPECT_FALSE(reader.nextLine(line));
+    }
+
+    // Unit testing - The registry should look up extensions case-insensitively and fall back to magic bytes in rule order
+    TEST(ConverterRegistryTests, Open_ShouldPickConverterByExtensionThenMagic) {
+
+        // Each factory reports its name as the only line
+        auto tagged = [](const std::string& tag) {
+            return [tag](const std::string&) { return std::unique_ptr<LineReader>(new FakeChunkLineReader(tag)); };
+        };
+        ConverterRegistry registry;
+        registry.registerExtension(".docx", tagged("docx"));
+        registry.registerMagic(30, "mimetypeapplication/vnd.oasis.opendocument.text", tagged("odt"));
+        registry.registerMagic(0, std::string("PK\x03\x04", 4), tagged("zip"));
+
+        auto openedBy = [&registry](const std::string& path) {
+            std::string line;
+            registry.open(path, std::filesystem::path(path).extension().string())->nextLine(line);
+            return line;
+        };
+
+        // Initialize the test data in a scratch directory
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_RegistryTest";
+        std::filesystem::create_directories(directory);
+        std::string upperCase = (directory / "RT_Document.DOCX").string();
+        std::string odfPackage = (directory / "RT_Package.bin").string();
+        std::string zipArchive = (directory / "RT_Archive.bin").string();
+        std::string unknown = (directory / "RT_Unknown.bin").string();
+        std::ofstream(upperCase) << "not read";
+        std::ofstream(odfPackage, std::ios::binary) << std::string("PK\x03\x04", 4) << std::string(26, '\0') << "mimetypeapplication/vnd.oasis.opendocument.text";
+        std::ofstream(zipArchive, std::ios::binary) << std::string("PK\x03\x04", 4) << std::string(26, '\0') << "word/document.xml";
+        std::ofstream(unknown) << "plain words";
+
+        EXPECT_EQ(openedBy(upperCase), "docx");
+        EXPECT_EQ(openedBy(odfPackage), "odt");
+        EXPECT_EQ(openedBy(zipArchive), "zip");
+        EXPECT_THROW(openedBy(unknown), std::runtime_error);
+
+        std::filesystem::remove_all(directory);
+    }
+
+
+    // Unit testing - Files with an unknown extension are claimed by magic bytes before they are sniffed as binary
+    TEST(ConverterRegistryTests, ShouldCompareBytes_ShouldCheckMagicBeforeBinarySniffing) {
+
+        ConverterRegistry registry;
+        registry.registerExtension(".txt", ConverterRegistry::plainText());
+        registry.registerMagic(0, std::string("PK\x03\x04", 4), ConverterRegistry::plainText());
+        registry.registerMagic(0, "{\\rtf", ConverterRegistry::plainText());
+
+        // Initialize the test data in a scratch directory
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "TextFileManager_ByteModeTest";
+        std::filesystem::create_directories(directory);
+        std::string zipArchive = (directory / "BM_Archive.bin").string();
+        std::string longRtf = (directory / "BM_Document.dat").string();
+        std::string binary = (directory / "BM_Data.bin").string();
+        std::string binaryText = (directory / "BM_Data.txt").string();
+        std::ofstream(zipArchive, std::ios::binary) << std::string("PK\x03\x04", 4) << std::string(26, '\0') << "word/document.xml";
+        std::ofstream(longRtf, std::ios::binary) << "{\\rtf1 " << std::string(20 * 1024, 'x') << "}";
+        std::ofstream(binary, std::ios::binary) << std::string("\x01\x00\x02", 3);
+        std::ofstream(binaryText, std::ios::binary) << std::string("PK\x03\x04", 4) << std::string(26, '\0');
+
+        // Both would look binary, but a converter claims them by their first bytes
+        EXPECT_FALSE(ByteComparator::shouldCompareBytes(zipArchive, ".bin", registry));
+        EXPECT_FALSE(ByteComparator::shouldCompareBytes(longRtf, ".dat", registry));
+
+        // Unclaimed files and .txt files are still sniffed
+        EXPECT_TRUE(ByteComparator::shouldCompareBytes(binary, ".bin", registry));
+        EXPECT_TRUE(ByteComparator::shouldCompareBytes(binaryText, ".TXT", registry));
+
+        // With the default rules only a Word package is claimed, other ZIP archives such as spreadsheets stay binary
+        std::string wordPackage = (directory / "BM_Letter.bin").string();
+        std::string spreadsheet = (directory / "BM_Book.xlsx").string();
+        auto writePackage = [](const std::string& path, const std::string& mainPart) {
+            ZipWriter zip(path);
+            zip.beginEntry("[Content_Types].xml");
+            zip.write("<Types/>");
+            zip.beginEntry(mainPart);
+            zip.write("<document/>");
+            zip.finish();
+        };
+        writePackage(wordPackage, "word/document.xml");
+        writePackage(spreadsheet, "xl/workbook.xml");
+        EXPECT_FALSE(ByteComparator::shouldCompareBytes(wordPackage, ".bin", ConverterRegistry::defaultRegistry()));
+        EXPECT_TRUE(ByteComparator::shouldCompareBytes(spreadsheet, ".xlsx", ConverterRegistry::defaultRegistry()));
+
+        std::filesystem::remove_all(directory);
+    }
+
+
 }
\ No newline at end of file